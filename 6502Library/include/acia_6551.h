@@ -0,0 +1,100 @@
+//
+// MOS 6551 Asynchronous Communications Interface Adapter: a serial port
+//
+
+#ifndef ACIA_6551_H
+#define ACIA_6551_H
+
+#include <deque>
+#include <string>
+
+#include "clocked_device.h"
+
+namespace emulator_6502 {
+
+    // Map it with memory.bus.mapDevice, the four registers repeat across the page
+    //
+    // Characters take as long as the baud rate in the control register says, worked out in CPU cycles
+    // from clock_hz. Sending and receiving are events, nothing runs between characters, see clocked_device.h
+    //
+    // The line is connected to host file descriptors, or to the buffers behind receive() and takeOutput()
+    // for a descriptor of -1. Descriptors are only read or written once poll() says they are ready, so
+    // the emulator never blocks on them and their flags are left alone. Output is buffered and written
+    // in batches. A received character waits in the host buffer while the last one is still unread
+    // instead of overrunning, like a line with flow control
+    //
+    // Not modelled: parity and framing errors, echo mode, the modem lines beyond DTR enabling the chip
+    class Acia6551 : public ClockedDevice {
+    public:
+        // Register select, the low two address bits
+        enum Register : Byte {
+            DATA, STATUS, COMMAND, CONTROL
+        };
+
+        // Status bits
+        static constexpr Byte
+            status_overrun  = 0b00000100,
+            status_rx_full  = 0b00001000,
+            status_tx_empty = 0b00010000,
+            status_irq      = 0b10000000;
+
+        Acia6551(CPU& cpu, Scheduler& scheduler, int input_fd = -1, int output_fd = -1, u32 irq_source = 2);
+        // Writes out whatever is still buffered, waiting for the descriptor if it has to
+        ~Acia6551() override;
+        Acia6551(const Acia6551&) = delete;
+        Acia6551& operator=(const Acia6551&) = delete;
+
+        // Clock the baud rates are converted with, the CPU's frequency
+        u64 clock_hz = 1'000'000;
+        // Output waits this many cycles for more before being written to output_fd
+        u64 flush_interval = 10'000;
+
+        // Queues characters on the line as if they came from input_fd
+        void receive(const std::string& bytes);
+        // Characters sent while output_fd is -1
+        std::string takeOutput();
+        // Writes as much buffered output as output_fd takes without blocking
+        void flush();
+
+        // CPU cycles one character takes with the current control and command registers
+        [[nodiscard]] u64 characterCycles() const;
+
+    protected:
+        Byte readRegister(Word address) override;
+        void writeRegister(Word address, Byte value) override;
+
+    private:
+        int input_fd;
+        int output_fd;
+        u32 irq_source;
+
+        Byte status = status_tx_empty;
+        Byte command = 0;
+        Byte control = 0;
+        Byte rx_data = 0;
+
+        Byte tx_data = 0;
+        Byte tx_shift = 0;
+        bool tx_busy = false;                   // tx_shift is being sent
+        std::deque<Byte> input;                 // Received from the host, not yet on the line
+        std::string output;                     // Sent, not yet written to the host
+
+        Scheduler::EventId tx_event = 0;
+        Scheduler::EventId rx_event = 0;
+        Scheduler::EventId flush_event = 0;
+
+        [[nodiscard]] bool enabled() const { return command & 0x01; }
+        void startTransmit(u64 now);
+        void transmitDone(u64 cycle);
+        void flushTick(u64 cycle);
+        void receiveTick(u64 cycle);
+        void scheduleReceive(u64 now);
+        void pollInput();
+        void writeOutput(bool wait);
+        void raiseIrq();
+        void updateIrq();
+    };
+
+}
+
+#endif //ACIA_6551_H
@@ -0,0 +1,59 @@
+//
+// Runs many independent CPU + Memory pairs across a pool of threads
+//
+
+#ifndef BATCH_RUNNER_H
+#define BATCH_RUNNER_H
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "emulator_6502.h"
+
+namespace emulator_6502 {
+
+    // One machine to run and, once the batch is done, its final state
+    // Aligned so neighbouring jobs being run on different threads do not share a cache line
+    struct alignas(64) BatchJob {
+        enum class Status {
+            Pending,    // Not finished yet
+            Finished,   // The whole cycle budget was run
+            Faulted     // Stopped on an exception, see 'error'
+        };
+
+        CPU cpu{};
+        std::unique_ptr<Memory> memory = std::make_unique<Memory>();
+        u64 cycle_budget = 0;
+
+        // Results
+        u64 cycles_run = 0;         // Exact, including what the last instruction ran past the budget
+        Status status = Status::Pending;
+        std::string error;
+
+        // Builds a job from a raw image copied in at load_address. The rest of memory is zeroed and
+        // the CPU is reset through the image's reset vector. Invalid opcodes fault without dumping memory
+        static BatchJob fromImage(const std::vector<Byte>& image, Word load_address, u64 cycle_budget);
+    };
+
+    // Schedules jobs on a work stealing pool. Each job is run in slices of 'slice_cycles' and put
+    // back on its worker's queue between slices, idle workers steal from the back of other queues
+    class BatchRunner {
+    public:
+        explicit BatchRunner(unsigned thread_count = std::thread::hardware_concurrency(), s32 slice_cycles = 100'000);
+
+        // Runs every job until its budget is used or it faults. Blocks until the batch is done
+        void run(std::vector<BatchJob>& jobs) const;
+
+        [[nodiscard]] unsigned threadCount() const { return thread_count; }
+        [[nodiscard]] s32 sliceCycles() const { return slice_cycles; }
+
+    private:
+        unsigned thread_count;
+        s32 slice_cycles;
+    };
+
+}
+
+#endif //BATCH_RUNNER_H
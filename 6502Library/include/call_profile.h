@@ -0,0 +1,104 @@
+//
+// Subroutine call graph profiler with inclusive and exclusive cycles
+//
+
+#ifndef CALL_PROFILE_H
+#define CALL_PROFILE_H
+
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "emulator_6502.h"
+
+namespace emulator_6502 {
+
+    // Keeps a shadow call stack from JSR / RTS and BRK / RTI and charges every instruction's cycles to
+    // the subroutine on top of it. Attach with cpu.call_profile = &profile
+    //
+    // Frames are popped by stack pointer rather than by counting returns, so code that drops its return
+    // address (PLA PLA, TXS) or returns through RTI does not leave stale frames behind
+    class CallProfile {
+    public:
+        struct Entry {
+            Word address;               // Subroutine entry point
+            u64 calls;
+            u64 inclusive_cycles;       // Including callees, recursion is only counted once
+            u64 exclusive_cycles;       // In the subroutine's own instructions
+        };
+
+        CallProfile();
+
+        // Called by execute around each instruction
+        void begin(const CPU& cpu) {
+            sp_before = cpu.SP;
+        }
+
+        void end(const CPU& cpu, Byte opcode, s32 cycles_used) {
+            cycle_count += cycles_used;
+            nodes[stack.back().node].exclusive_cycles += cycles_used;
+            switch (opcode) {
+                case 0x20:  // JSR
+                case 0x00:  // BRK
+                    enter(cpu);
+                    break;
+                case 0x60:  // RTS
+                case 0x40:  // RTI
+                    leave(cpu);
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        // Names used in the output instead of $XXXX
+        void setSymbol(Word address, std::string name);
+
+        void reset();
+        [[nodiscard]] u64 totalCycles() const { return cycle_count; }
+        [[nodiscard]] size_t depth() const { return stack.size() - 1; }
+
+        // Per subroutine totals, most inclusive cycles first. Open frames count up to now
+        [[nodiscard]] std::vector<Entry> entries() const;
+
+        // One "root;outer;inner cycles" line per call path, exclusive cycles, for flamegraph.pl and
+        // compatible tools
+        void writeCollapsed(std::ostream& out) const;
+        // address,name,calls,inclusive_cycles,exclusive_cycles
+        void writeCsv(std::ostream& out) const;
+
+    private:
+        // One node per distinct call path, node 0 is the root
+        struct Node {
+            Word address;
+            u32 parent;
+            u64 calls;
+            u64 inclusive_cycles;       // Closed activations
+            u64 exclusive_cycles;
+        };
+
+        struct Frame {
+            u32 node;
+            Byte sp;                    // SP before the call, the frame is gone once SP is back above it
+            u64 start_cycle;
+        };
+
+        std::vector<Node> nodes;
+        std::unordered_map<u64, u32> children;     // (parent << 16 | address) -> node
+        std::vector<Frame> stack;
+        std::unordered_map<Word, std::string> symbols;
+        u64 cycle_count = 0;
+        Byte sp_before = 0;
+
+        void enter(const CPU& cpu);
+        void leave(const CPU& cpu);
+        void popReleasedFrames(Byte sp);
+        [[nodiscard]] std::string name(Word address) const;
+        [[nodiscard]] std::string path(u32 node) const;
+        [[nodiscard]] u64 openCycles(u32 node) const;
+    };
+
+}
+
+#endif //CALL_PROFILE_H
@@ -0,0 +1,73 @@
+//
+// Base for bus devices that are simulated lazily against the CPU's clock
+//
+
+#ifndef CLOCKED_DEVICE_H
+#define CLOCKED_DEVICE_H
+
+#include <functional>
+
+#include "emulator_6502.h"
+#include "scheduler.h"
+
+namespace emulator_6502 {
+
+    // A device that is never stepped along with the CPU. Its state is as of lastSync(), and it is only
+    // simulated forward to cpu.cycle() when the CPU reads or writes one of its registers, or to the due
+    // cycle when one of its events fires. A device nobody touches and that has nothing scheduled costs
+    // nothing while execute runs
+    //
+    // Derived classes implement the register accesses, catchUp for anything that changes smoothly with
+    // time such as counters, and post events for whatever the CPU must notice when it happens, such as
+    // an interrupt. They cancel their events when destroyed
+    class ClockedDevice : public BusDevice {
+    public:
+        ClockedDevice(CPU& cpu, Scheduler& scheduler) : cpu(cpu), scheduler(scheduler), last_sync(cpu.cycle()) {}
+
+        Byte read(Word address) final {
+            sync(cpu.cycle());
+            return readRegister(address);
+        }
+
+        void write(Word address, Byte value) final {
+            sync(cpu.cycle());
+            writeRegister(address, value);
+        }
+
+        // Simulates forward to 'cycle', earlier cycles are ignored. Host code looking at the device's
+        // state between accesses calls sync() first
+        void sync(u64 cycle) {
+            if (cycle > last_sync) {
+                catchUp(cycle - last_sync);
+                last_sync = cycle;
+                catch_ups++;
+            }
+        }
+        void sync() { sync(cpu.cycle()); }
+
+        [[nodiscard]] u64 lastSync() const { return last_sync; }
+        [[nodiscard]] u64 catchUps() const { return catch_ups; }
+
+    protected:
+        CPU& cpu;
+        Scheduler& scheduler;
+
+        virtual Byte readRegister(Word address) = 0;
+        virtual void writeRegister(Word address, Byte value) = 0;
+        // Runs the device for 'cycles' more
+        virtual void catchUp(u64 cycles) { (void)cycles; }
+
+        // Posts 'callback' for 'cycle' in place of the event in 'slot', which is zeroed once it has run.
+        // The device is synced to the due cycle before the callback, and execute looks at the new deadline
+        // before its next instruction
+        void post(Scheduler::EventId& slot, u64 cycle, std::function<void(u64)> callback);
+        void cancel(Scheduler::EventId& slot);
+
+    private:
+        u64 last_sync;
+        u64 catch_ups = 0;
+    };
+
+}
+
+#endif //CLOCKED_DEVICE_H
@@ -0,0 +1,107 @@
+//
+// Pre-decoded instructions keyed by PC, used by the decoded core
+//
+
+#ifndef DECODED_CACHE_H
+#define DECODED_CACHE_H
+
+#include <array>
+#include <memory>
+
+#include "emulator_6502.h"
+
+namespace emulator_6502 {
+
+    // Instruction sequences the decoded core runs as one superinstruction, picked from the hottest
+    // pairs in OpcodeProfile over the bench workloads plus the usual loop idioms. Every instruction
+    // but the last is one that neither writes memory nor changes PC, so the ones after it are always
+    // still there to run
+    //
+    // X(name, first, second) for pairs and Y(name, first, second, third) for triples
+    #define EMULATOR_6502_SUPERINSTRUCTIONS(X, Y)       \
+    Y(INY_CPY_IM_BNE,       0xC8, 0xC0, 0xD0)           \
+    Y(INX_CPX_IM_BNE,       0xE8, 0xE0, 0xD0)           \
+    X(DEX_BNE,              0xCA, 0xD0)                 \
+    X(DEY_BNE,              0x88, 0xD0)                 \
+    X(INX_BNE,              0xE8, 0xD0)                 \
+    X(INY_BNE,              0xC8, 0xD0)                 \
+    X(CMP_IM_BEQ,           0xC9, 0xF0)                 \
+    X(CMP_IM_BNE,           0xC9, 0xD0)                 \
+    X(CPX_IM_BNE,           0xE0, 0xD0)                 \
+    X(CPY_IM_BNE,           0xC0, 0xD0)                 \
+    X(LDA_ABSX_STA_ABSX,    0xBD, 0x9D)                 \
+    X(LDA_ABSY_STA_ABSY,    0xB9, 0x99)                 \
+    X(LDA_ZP_STA_ABS,       0xA5, 0x8D)                 \
+    X(CLC_ADC_IM,           0x18, 0x69)                 \
+    X(SEC_SBC_IM,           0x38, 0xE9)                 \
+    X(CLC_BCC,              0x18, 0x90)                 \
+    X(CLV_BVC,              0xB8, 0x50)
+
+    enum class Superinstruction : Byte {
+        None,
+        #define EMULATOR_6502_SUPERINSTRUCTION_NAME(name, ...) name,
+        EMULATOR_6502_SUPERINSTRUCTIONS(EMULATOR_6502_SUPERINSTRUCTION_NAME, EMULATOR_6502_SUPERINSTRUCTION_NAME)
+        #undef EMULATOR_6502_SUPERINSTRUCTION_NAME
+    };
+
+    // Only what the loop uses: the handlers fetch their own operands and charge their own cycles, so
+    // an entry saves the opcode fetch and carries the superinstruction, nothing more
+    struct DecodedInstruction {
+        Byte opcode = 0;
+        Byte length = 0;                        // Opcode plus operand bytes, 0 while the entry is empty
+        // Set when this instruction starts one of the sequences above. Only sequences that fit on this
+        // instruction's page are fused, so a write to any of their bytes drops the entry
+        Superinstruction fused = Superinstruction::None;
+    };
+
+    // Decoded instructions stored a page at a time, a page's table is only allocated once code runs in it
+    //
+    // Owned by the bus it decodes from, see Bus::decodedCache(). Every page with decoded entries is a
+    // code page on that bus, so the first write to it goes down the slow path and drops the page's
+    // entries, after which writes are direct again until code from the page is decoded once more
+    class DecodedCache {
+    public:
+        // The instruction at pc, decoded on the first visit. nullptr when it cannot be cached: invalid
+        // opcodes, and code on pages that do not read directly from memory (devices, watched pages)
+        const DecodedInstruction* lookup(Word pc, Bus& bus) {
+            const Table* table = tables[pc >> 8].get();
+            if (table) {
+                const DecodedInstruction& entry = table->entries[pc & 0xFF];
+                if (entry.length) {
+                    return &entry;
+                }
+            }
+            return decode(pc, bus);
+        }
+
+        // Entry for pc if it is already decoded, without decoding
+        [[nodiscard]] const DecodedInstruction* find(Word pc) const;
+
+        // Drops the entries that read from the page. Tables stay allocated for when the code is decoded again
+        void invalidatePage(u32 index);
+        void clear();
+
+        [[nodiscard]] u64 decodes() const { return decode_count; }
+        [[nodiscard]] u64 invalidations() const { return invalidation_count; }
+        [[nodiscard]] u64 fusions() const { return fusion_count; }
+
+        // Set to false before running to keep every instruction separate
+        bool fuse = true;
+
+    private:
+        struct Table {
+            std::array<DecodedInstruction, Bus::PAGE_SIZE> entries{};
+        };
+
+        std::array<std::unique_ptr<Table>, Bus::PAGE_COUNT> tables;
+        u64 decode_count = 0;
+        u64 invalidation_count = 0;
+        u64 fusion_count = 0;
+
+        const DecodedInstruction* decode(Word pc, Bus& bus);
+        Superinstruction superinstructionAt(Word pc, Bus& bus) const;
+    };
+
+}
+
+#endif //DECODED_CACHE_H
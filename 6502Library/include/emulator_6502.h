@@ -5,16 +5,35 @@
 #ifndef EMULATOR_6502_H
 #define EMULATOR_6502_H
 
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <memory>
 #include <string>
 #include <iostream>
 #include <iomanip>
+#include <limits>
 #include <set>
 #include <sstream>
 #include <fstream>
 #include <filesystem>
+#include <functional>
+#include <optional>
 #include <chrono>
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
 
 
+// Hot loops ask the compiler to inline everything they call, cold paths are kept out of them
+#if defined(__GNUC__) || defined(__clang__)
+    #define EMULATOR_6502_FLATTEN __attribute__((flatten))
+    #define EMULATOR_6502_NOINLINE __attribute__((noinline))
+#else
+    #define EMULATOR_6502_FLATTEN
+    #define EMULATOR_6502_NOINLINE
+#endif
+
 namespace  emulator_6502 {
 
     using Byte = uint8_t;
@@ -26,23 +45,280 @@ namespace  emulator_6502 {
 
     using u32 = uint32_t;
     using s32 = signed int;
+    using u64 = uint64_t;
+
+    class InstructionTrace;
+    struct OpcodeProfile;
+    class CallProfile;
+    class DecodedCache;
+    class Scheduler;
+    class JitCache;
+
+    // Anything mapped onto the bus that is not plain memory (I/O registers etc.)
+    class BusDevice {
+    public:
+        virtual ~BusDevice() = default;
+
+        // address is the full 16-bit address that was accessed
+        virtual Byte read(Word address) = 0;
+        virtual void write(Word address, Byte value) = 0;
+    };
+
+    // Decodes addresses a page (256 bytes) at a time
+    // Each page is direct RAM, read only ROM, a device or unmapped
+    class Bus {
+    public:
+        static constexpr u32 PAGE_SIZE = 256;
+        static constexpr u32 PAGE_COUNT = 256;
+
+        // RAM page that can be shared between forked buses, copied on the first write
+        using PageBlock = std::array<Byte, PAGE_SIZE>;
+
+        enum class PageType : Byte {
+            Unmapped,
+            RAM,
+            ROM,
+            Device
+        };
+
+        struct Page {
+            Byte* backing = nullptr;        // Start of the page for RAM / ROM
+            BusDevice* device = nullptr;
+            PageType type = PageType::Unmapped;
+            std::shared_ptr<PageBlock> block;   // Set when 'backing' is a shareable block
+            std::shared_ptr<const void> owner;  // Keeps a ROM's backing alive while the page maps it
+        };
+
+        Bus();
+        Bus(const Bus& other);
+        Bus(Bus&& other) noexcept;
+        Bus& operator=(const Bus& other);
+        Bus& operator=(Bus&& other) noexcept;
+        ~Bus();
+
+        // Read 1 Byte - RAM and ROM are a table lookup plus an offset
+        Byte read(Word address) {
+            Byte* page = read_map[address >> 8];
+            if (page) {
+                return page[address & 0xFF];
+            }
+            return readSlow(address);
+        }
+
+        // Write 1 Byte - RAM is a table lookup plus an offset
+        void write(Word address, Byte value) {
+            Byte* page = write_map[address >> 8];
+            if (page) {
+                page[address & 0xFF] = value;
+                return;
+            }
+            writeSlow(address, value);
+        }
+
+        // Read 1 Byte without side effects, devices and unmapped pages read as 0x00
+        [[nodiscard]] Byte peek(Word address) const {
+            const Byte* page = read_map[address >> 8];
+            if (page) {
+                return page[address & 0xFF];
+            }
+            const Page& slow = pages[address >> 8];
+            return (slow.type == PageType::RAM || slow.type == PageType::ROM) ? slow.backing[address & 0xFF] : 0x00;
+        }
+
+        // Start of the page holding address if it reads directly from memory, otherwise nullptr
+        [[nodiscard]] const Byte* readPage(Word address) const {
+            return read_map[address >> 8];
+        }
+
+        // Mapping. start and length must be page aligned, backing points at the byte for 'start'
+        // A ROM given an owner holds on to it until the last page mapping it, in this bus or a fork, is remapped
+        void mapRAM(u32 start, u32 length, Byte* backing);
+        void mapROM(u32 start, u32 length, const Byte* backing, std::shared_ptr<const void> owner = nullptr);
+        void mapDevice(u32 start, u32 length, BusDevice* device);
+        void unmap(u32 start, u32 length);
+
+        [[nodiscard]] const Page& page(Word address) const {
+            return pages[address >> 8];
+        }
+
+        // Repoints pages backed by [old_base, old_base + length) at new_base
+        void rebase(const Byte* old_base, Byte* new_base, u32 length);
+
+        // Copy on write
+        // Moves RAM pages backed by [base, base + length) into their own shareable blocks
+        void share(const Byte* base, u32 length);
+        // Returns a bus sharing every block with this one. Costs one pointer copy per page, a block
+        // is only copied when one side first writes to it. Other pages are shared as they are
+        [[nodiscard]] Bus fork();
+        // Start of the page's RAM ready to be written: a shared block is copied first and the page is
+        // marked dirty. nullptr if the page is not RAM
+        Byte* writablePage(u32 index);
+
+        // Dirty page tracking. While enabled, the first write to each RAM page since the last
+        // clearDirty() takes the slow path once to set its bit, later writes to it are direct
+        void setDirtyTracking(bool enabled);
+        void clearDirty();
+        [[nodiscard]] bool dirtyTracking() const { return track_dirty; }
+        [[nodiscard]] const std::bitset<PAGE_COUNT>& dirtyPages() const { return dirty; }
+
+        // Watchpoints. Pages with a read or write watchpoint lose their fast path pointer, so only
+        // accesses to those pages pay for the check
+        static constexpr Byte
+            watch_read    = 0b001,
+            watch_write   = 0b010,
+            watch_execute = 0b100;
+
+        struct WatchHit {
+            u32 id;                 // As returned by addWatchpoint
+            Word address;
+            Byte value;             // Byte read, about to be written, or the opcode
+            Byte access;            // One of watch_read / watch_write / watch_execute
+        };
+
+        // Called on every matching access, a write before it lands. Returns true to stop run() after
+        // the current instruction, or before it for execute. Must not add or remove watchpoints
+        using WatchCallback = std::function<bool(const WatchHit&)>;
+
+        // Watches [start, start + length) for the accesses in 'access'. With no callback every hit stops run()
+        u32 addWatchpoint(Word start, u32 length, Byte access, WatchCallback callback = {});
+        bool removeWatchpoint(u32 id);
+        void clearWatchpoints();
+        [[nodiscard]] bool watching() const { return !watchpoints.empty(); }
+
+        // The bus cannot tell opcode fetches from other reads, run() calls this before each instruction
+        void checkExecute(Word address);
+        // Hands over the first hit that asked to stop since the last call
+        bool takeWatchStop(WatchHit& hit);
+
+        // Decoded instruction cache for the decoded core, created on first use and never copied
+        DecodedCache& decodedCache();
+        // Translated blocks for the JIT core, the same way
+        JitCache& jitCache();
+        // Makes the page a code page: its next write takes the slow path and invalidates the page's
+        // decoded instructions and translated blocks. Called by the caches while decoding
+        void markCode(u32 index);
+        // Drops every decoded instruction and translated block, needed after changing code behind the
+        // bus's back, for example in a ROM image, a buffer given to mapRAM or Memory::data
+        void clearDecodedCache();
+        // Goes up every time a code page is invalidated
+        [[nodiscard]] u64 codeGeneration() const { return code_generation; }
+
+        // The fast lookups, for generated code that does the same lookup as read() / write()
+        [[nodiscard]] Byte* const* readMap() const { return read_map.data(); }
+        [[nodiscard]] Byte* const* writeMap() const { return write_map.data(); }
+
+    private:
+        struct Watchpoint {
+            u32 id;
+            u32 start;
+            u32 end;
+            Byte access;
+            WatchCallback callback;
+        };
+
+        // The hot lookups are kept as plain pointer arrays, nullptr sends the access down the slow path
+        std::array<Byte*, PAGE_COUNT> read_map{};
+        std::array<Byte*, PAGE_COUNT> write_map{};
+        std::array<Page, PAGE_COUNT> pages{};
+        std::bitset<PAGE_COUNT> dirty;
+        bool track_dirty = false;
+
+        std::vector<Watchpoint> watchpoints;
+        std::bitset<PAGE_COUNT> watched_read;
+        std::bitset<PAGE_COUNT> watched_write;
+        std::bitset<PAGE_COUNT> watched_execute;
+        u32 next_watch_id = 1;
+        bool watch_stop = false;
+        WatchHit stop_hit{};
+
+        std::unique_ptr<DecodedCache> decoded;
+        std::unique_ptr<JitCache> jit;
+        std::bitset<PAGE_COUNT> code_pages;
+        u64 code_generation = 0;
+
+        void setPage(u32 index, const Page& page);
+        void invalidateCode(u32 index);
+        void updateWatchedPages();
+        void hitWatchpoints(Word address, Byte value, Byte access);
+        EMULATOR_6502_NOINLINE Byte readSlow(Word address);
+        EMULATOR_6502_NOINLINE void writeSlow(Word address, Byte value);
+        static void checkRange(u32 start, u32 length);
+    };
 
     class Memory {
     public:
         static constexpr u32 MAX_MEMORY = 1024 * 64;
-        Byte data[MAX_MEMORY];
+        // All CPU accesses go through the bus. By default every page is RAM backed by the memory's own array
+        Bus bus;
 
+        // RAM until the first fork, and what device and unmapped pages copy in and out. Only use it before
+        // forking: after that the CPU reads and writes shared blocks instead and changes here are not seen.
+        // Writes to code pages also need bus.clearDecodedCache(). operator[] and copyIn work either way
+        Byte data[MAX_MEMORY];
 
-        // Read 1 Byte
+        Memory();
+        Memory(const Memory& other);
+        Memory& operator=(const Memory& other);
+
+        // Copy on write clone. The first fork moves RAM into shared blocks, after that forking and running
+        // costs O(pages written) rather than a 64K copy. Devices are shared
+        [[nodiscard]] std::unique_ptr<Memory> fork();
+
+        // Whole address space as the CPU sees RAM and ROM. Device and unmapped pages have RAM of their own
+        // underneath, which is what is copied for them. No device accesses
+        void copyOut(Byte* out) const;
+        void copyIn(const Byte* in);
+        // Copies length bytes in starting at address, anything past the end of memory is dropped
+        void copyIn(Word address, const Byte* in, size_t length);
+
+        // Dirty page tracking. Writes through the bus (CPU::writeByte, writeWord, the stack) mark
+        // their page, checkpoint() clears the marks. Enabling takes a checkpoint, forks start with it off
+        struct Range {
+            Word start;
+            u32 length;
+        };
+
+        void setDirtyTracking(bool enabled);
+        void checkpoint();
+        [[nodiscard]] const std::bitset<Bus::PAGE_COUNT>& dirtyPages() const { return bus.dirtyPages(); }
+        // Byte ranges that differ from the last checkpoint. Only dirty pages are compared
+        [[nodiscard]] std::vector<Range> changedRanges() const;
+
+        // Read 1 Byte the way copyOut does, devices are not accessed
         Byte operator[] (u32 address) const {
-            return data[address];
+            return byteAt(address);
         }
 
-        // Write 1 Bytes
-        Byte& operator[] (u32 address) {
-            return data[address];
+        // One byte of a non-const Memory. Reading it goes through byteAt, so it leaves the page alone,
+        // and assigning it goes through copyIn, so only writes drop decoded code, copy a shared page and
+        // mark it dirty. It looks the page up on every access, so one kept across a fork still writes
+        // to this memory's own copy
+        class Cell {
+        public:
+            Cell(Memory& memory, u32 address) : memory(memory), address(static_cast<Word>(address)) {}
+
+            operator Byte() const {
+                return memory.byteAt(address);
+            }
+            Cell& operator=(Byte value) {
+                memory.copyIn(address, &value, 1);
+                return *this;
+            }
+            Cell& operator=(const Cell& other) {
+                return *this = static_cast<Byte>(other);
+            }
+
+        private:
+            Memory& memory;
+            Word address;
+        };
+
+        // Read or write 1 Byte the way copyOut / copyIn do. Devices and watchpoints are bypassed
+        Cell operator[] (u32 address) {
+            return Cell(*this, address);
         }
 
+        // These write through copyIn as well, so they work the same before and after a fork
         void initMemory();
         void setMemory(Byte to_set);
         bool loadMemory(std::string& loc);
@@ -50,13 +326,39 @@ namespace  emulator_6502 {
         void promptMemoryLoad();
 
         // Memory Dumps
+        enum class DumpFormat {
+            Hex,        // Address, hex bytes and ASCII, 16 bytes per row (.txt)
+            Binary      // The raw bytes (.bin)
+        };
+
         void dumpMemory(size_t start = 0, size_t length = 256);
-        void dumpMemoryToFile(size_t start = 0, size_t length = 256);
+        void dumpMemoryToFile(size_t start = 0, size_t length = 256, DumpFormat format = DumpFormat::Hex);
 
         // Writing
         void writeWord(s32& clock_cycles, u32 address, Word value);
 
+    private:
+        // Contents at the last checkpoint, only allocated while tracking
+        std::unique_ptr<Byte[]> baseline;
+
+        [[nodiscard]] const Byte* pageContents(u32 index) const;
+        [[nodiscard]] Byte byteAt(size_t address) const { return pageContents((address >> 8) & 0xFF)[address & 0xFF]; }
+        void fill(Byte value);
+
+        size_t formatDump(std::vector<char>& buffer, size_t start, size_t length, size_t bytes_per_row) const;
+        static std::vector<char>& dumpBuffer();
+    };
+
+    // One bit per address, run() tests the bit for PC before every instruction
+    class Breakpoints {
+    public:
+        void set(Word address) { bits[address >> 6] |= u64{1} << (address & 63); }
+        void clear(Word address) { bits[address >> 6] &= ~(u64{1} << (address & 63)); }
+        void clearAll() { bits.fill(0); }
+        [[nodiscard]] bool test(Word address) const { return (bits[address >> 6] >> (address & 63)) & 1; }
 
+    private:
+        std::array<u64, 0x10000 / 64> bits{};
     };
 
     class CPU {
@@ -108,7 +410,157 @@ namespace  emulator_6502 {
         static void writeByte(s32& clock_cycles, Memory& memory, Word address, Byte value);
 
 
+        // *** Execution ***
+        // Interpreter loops that execute() can run
+        enum class Core {
+            DispatchTable,  // Calls through dispatch_table for every instruction
+            Switch,         // One switch over the opcode with the handlers inlined into it
+            Decoded,        // The switch, fed from the bus's DecodedCache instead of fetching the opcode, see decoded_cache.h
+            Jit             // Translated blocks from the bus's JitCache with the interpreter for the rest, see jit.h
+        };
+        Core core = Core::Switch;
+        // Core::Jit only: replays everything on an interpreted copy of the machine and throws
+        // JitMismatchException at the first difference. Very slow, for testing the translator
+        bool jit_verify = false;
+        // Lets execute() fast-forward loops that can never leave, such as JMP * or a poll of memory that
+        // nothing writes. Skipped iterations are charged exactly, so results are the same either way
+        bool skip_idle_loops = true;
+
+        // What gets written to dumps/ before an InvalidInstructionException is thrown
+        enum class InvalidOpcodeDump {
+            None,       // Nothing, for crash heavy runs such as fuzzing
+            Hex,
+            Binary
+        };
+        InvalidOpcodeDump invalid_opcode_dump = InvalidOpcodeDump::Hex;
+
+        // Records every instruction when set, see instruction_trace.h
+        InstructionTrace* trace = nullptr;
+        // Counts executions and cycles per opcode when set, see opcode_profile.h
+        OpcodeProfile* profile = nullptr;
+        // Charges cycles to subroutines when set, see call_profile.h
+        CallProfile* call_profile = nullptr;
+
+        // Running totals of events inside instructions, read by the profilers
+        u64 page_crossings = 0;     // Extra cycles charged by getIndirectYAddr / getAbsoluteAddrOffset
+        u64 branches_taken = 0;
+        u64 idle_iterations_skipped = 0;
+
+        // *** Interrupts ***
+        // Runs device events between instructions when set, see scheduler.h
+        Scheduler* scheduler = nullptr;
+
+        // IRQ is level triggered: it is held while any source asserts it, each device picking its own
+        // bit, and is taken between instructions while flags.I is clear. NMI is edge triggered and is
+        // taken once per triggerNMI(). Either can be called from devices and scheduler events while
+        // execute is running, the interrupt is then taken at the next instruction boundary
+        void setIRQ(u32 source, bool asserted);
+        void triggerNMI();
+        [[nodiscard]] bool irqAsserted() const { return irq_sources != 0; }
+        // Makes execute look at the scheduler again before the next instruction. Devices call it after
+        // posting an event from a register access, events posted from other events are picked up anyway
+        void pollSoon() { poll_budget = std::numeric_limits<s32>::max(); }
+        u32 irq_sources = 0;
+        bool nmi_pending = false;
+        u64 interrupts_taken = 0;
+
+        static constexpr Word NMI_VECTOR = 0xFFFA;
+        static constexpr Word IRQ_VECTOR = 0xFFFE;
+
+        // The loops look at interrupts and the scheduler only once the budget is down to this, which
+        // is the lowest s32 while there is nothing to do. Kept up to date by pollInterrupts
+        s32 poll_budget = std::numeric_limits<s32>::min();
+        u64 slice_start = 0;        // cycle() when the running execute call started
+        s32 slice_budget = 0;       // Budget that call was given
+        s32 clock_budget = 0;       // Budget left when the current instruction started, stored by the loops
+
+        // Cycles run since the CPU was created, as of the start of the current instruction while execute
+        // is running. This is the clock devices and the scheduler use. Counted in the units of the
+        // timing policy, like the budget. It only goes forward, reset() leaves it alone, and the cycles the
+        // last instruction of each call runs past the budget are counted too
+        [[nodiscard]] u64 cycle() const { return slice_start + (static_cast<int64_t>(slice_budget) - clock_budget); }
+        // Cycles the last executeCycles call ran past what it was asked for, owed by the next one
+        u64 carried_cycles = 0;
+
+        // How the budget passed to execute is counted. Chosen at compile time, every policy runs the
+        // same instruction handlers
+        enum class Timing {
+            Exact,          // Each access charges its own cycle, page crossing and branch penalties included
+            Fast,           // Each instruction charges its base cycles from opcode_table once
+            Instructions    // The budget is a number of instructions, cycles are not counted at all
+        };
+
         void execute(s32 cycles, Memory& memory);
+        template <Timing timing> void execute(s32 budget, Memory& memory);
+        // Runs 'cycles' less carried_cycles and returns the cycles that actually ran, overshoot included.
+        // The overshoot is carried into the next call, so a run split into slices keeps the same time as
+        // one call. Budgets beyond s32 are run as several executes
+        u64 executeCycles(u64 cycles, Memory& memory);
+        template <Timing timing> u64 executeCycles(u64 cycles, Memory& memory);
+        template <Timing timing = Timing::Exact> void executeDispatchTable(s32 budget, Memory& memory);
+        template <Timing timing = Timing::Exact> void executeSwitch(s32 budget, Memory& memory);
+        template <Timing timing = Timing::Exact> void executeDecoded(s32 budget, Memory& memory);
+        // Translated blocks only keep exact time, other policies and instrumented runs use the switch core
+        template <Timing timing = Timing::Exact> void executeJit(s32 budget, Memory& memory);
+        // Runs one instruction through the dispatch table and returns the cycles it took, cycle() moves on by them
+        s32 step(Memory& memory);
+        // step() for the loops, which count the cycles in their budget instead
+        s32 runInstruction(Memory& memory);
+        // The loops behind the two cores. The instrumented versions call the trace and profilers, the
+        // plain ones are used while none are attached and contain no hooks at all
+        template <Timing timing, bool Instrumented>
+        EMULATOR_6502_NOINLINE void runDispatchTable(s32 budget, Memory& memory);
+        template <Timing timing, bool Instrumented>
+        EMULATOR_6502_FLATTEN EMULATOR_6502_NOINLINE void runSwitch(s32 budget, Memory& memory);
+        template <Timing timing, bool Instrumented>
+        EMULATOR_6502_FLATTEN EMULATOR_6502_NOINLINE void runDecoded(s32 budget, Memory& memory);
+        EMULATOR_6502_NOINLINE void runJit(s32 budget, Memory& memory);
+        // Called by the loops on entry and exit, and between instructions once the budget reaches poll_budget
+        void beginSlice(s32 budget);
+        void endSlice(s32 budget);
+        template <Timing timing>
+        EMULATOR_6502_NOINLINE void pollInterrupts(s32& budget, Memory& memory);
+        void updatePollBudget(s32 budget);
+        // Pushes PC and the flags with B clear, sets I and jumps through the vector. 7 cycles
+        void serviceInterrupt(s32& clock_cycles, Memory& memory, Word vector);
+        [[noreturn]] EMULATOR_6502_NOINLINE void invalidInstruction(Memory& memory);
+        EMULATOR_6502_NOINLINE void dumpInvalidInstruction(Memory& memory);
+
+        // Why run() came back
+        enum class StopReason {
+            Budget,         // The budget ran out
+            Breakpoint,     // PC reached an address set in RunOptions::breakpoints
+            Break,          // The next instruction is a BRK and RunOptions::stop_on_brk is set
+            InvalidOpcode,  // The next opcode has no handler, nothing is thrown
+            HaltAddress,    // PC reached RunOptions::halt_address
+            Callback,       // RunOptions::callback returned true
+            Watchpoint      // A watchpoint asked to stop, see RunResult::watch
+        };
+
+        struct RunOptions {
+            const Breakpoints* breakpoints = nullptr;
+            std::optional<Word> halt_address;
+            bool stop_on_brk = false;
+            // Called before every instruction, returning true stops. Leave empty when not needed, it
+            // costs an indirect call per instruction
+            std::function<bool(CPU&, Memory&)> callback;
+        };
+
+        struct RunResult {
+            StopReason reason;
+            s32 cycles;             // Budget used, counted the way the timing policy says
+            u64 instructions;       // Instructions retired
+            Bus::WatchHit watch;    // The hit that stopped the run, for StopReason::Watchpoint
+        };
+
+        // Like execute, but stops before the first instruction that meets a stop condition and reports
+        // why. PC is left on that instruction, which has not run. The instruction at the starting PC
+        // always runs, so calling run() again continues past the stop
+        // Read and write watchpoints stop after the instruction that made the access
+        RunResult run(s32 budget, Memory& memory);
+        RunResult run(s32 budget, Memory& memory, const RunOptions& options);
+        template <Timing timing>
+        EMULATOR_6502_FLATTEN EMULATOR_6502_NOINLINE RunResult run(s32 budget, Memory& memory, const RunOptions& options);
 
         // *** Address Helpers ***
         Word getIndirectXAddr(s32& clock_cycles, Memory& memory);
@@ -297,9 +749,70 @@ namespace  emulator_6502 {
     // Opcode dispatch table
     using InstructionHandler = void (*)(CPU& cpu, s32& cycles, Memory& memory);
     static constexpr int OPCODE_COUNT = 256;
-    inline InstructionHandler dispatch_table[OPCODE_COUNT] = { nullptr };
 
-    void initDispatchTable();
+    enum class AddressingMode : Byte {
+        Implied,
+        Accumulator,
+        Immediate,
+        ZeroPage,
+        ZeroPageX,
+        ZeroPageY,
+        Relative,
+        Absolute,
+        AbsoluteX,
+        AbsoluteY,
+        Indirect,
+        IndirectX,
+        IndirectY
+    };
+
+    // Static description of an opcode, shared by the cores, tools and cycle counting
+    struct OpcodeInfo {
+        const char* mnemonic = "???";
+        AddressingMode mode = AddressingMode::Implied;
+        Byte cycles = 0;                        // Base cycles, 0 for opcodes that are not implemented
+        Byte page_penalty = 0;                  // Extra cycles when the effective address crosses a page
+        InstructionHandler handler = nullptr;
+    };
+
+    // Number of operand bytes that follow the opcode
+    constexpr Byte operandBytes(AddressingMode mode) {
+        switch (mode) {
+            case AddressingMode::Implied:
+            case AddressingMode::Accumulator:
+                return 0;
+            case AddressingMode::Absolute:
+            case AddressingMode::AbsoluteX:
+            case AddressingMode::AbsoluteY:
+            case AddressingMode::Indirect:
+                return 2;
+            default:
+                return 1;
+        }
+    }
+
+    constexpr const char* addressingModeName(AddressingMode mode) {
+        switch (mode) {
+            case AddressingMode::Implied:     return "implied";
+            case AddressingMode::Accumulator: return "accumulator";
+            case AddressingMode::Immediate:   return "immediate";
+            case AddressingMode::ZeroPage:    return "zeropage";
+            case AddressingMode::ZeroPageX:   return "zeropage_x";
+            case AddressingMode::ZeroPageY:   return "zeropage_y";
+            case AddressingMode::Relative:    return "relative";
+            case AddressingMode::Absolute:    return "absolute";
+            case AddressingMode::AbsoluteX:   return "absolute_x";
+            case AddressingMode::AbsoluteY:   return "absolute_y";
+            case AddressingMode::Indirect:    return "indirect";
+            case AddressingMode::IndirectX:   return "indirect_x";
+            case AddressingMode::IndirectY:   return "indirect_y";
+        }
+        return "";
+    }
+
+    // The table is built at compile time, calling this is no longer needed
+    [[deprecated("dispatch_table is built at compile time")]]
+    inline void initDispatchTable() {}
 
     // Wrapper functions - LDA
     inline void handle_LDA_IM(CPU& cpu, s32& cycles, Memory& memory) {
@@ -805,6 +1318,267 @@ namespace  emulator_6502 {
         cpu.returnFromInterrupt(cycles, memory);
     }
 
+
+    // Every implemented opcode and how it executes
+    // X(opcode, handler, mnemonic, addressing mode, base cycles, page cross penalty) is expanded once per opcode
+    // to build opcode_table, dispatch_table and the switch core.
+    // Branches take one extra cycle when taken, on top of the page cross penalty.
+    #define EMULATOR_6502_OPCODES(X)                        \
+    /* Load Registers */                                    \
+    /* LDA */                                               \
+    X(0xA9, handle_LDA_IM,   "LDA", Immediate,   2, 0)      \
+    X(0xA5, handle_LDA_ZP,   "LDA", ZeroPage,    3, 0)      \
+    X(0xB5, handle_LDA_ZPX,  "LDA", ZeroPageX,   4, 0)      \
+    X(0xAD, handle_LDA_ABS,  "LDA", Absolute,    4, 0)      \
+    X(0xBD, handle_LDA_ABSX, "LDA", AbsoluteX,   4, 1)      \
+    X(0xB9, handle_LDA_ABSY, "LDA", AbsoluteY,   4, 1)      \
+    X(0xA1, handle_LDA_INDX, "LDA", IndirectX,   6, 0)      \
+    X(0xB1, handle_LDA_INDY, "LDA", IndirectY,   5, 1)      \
+                                                            \
+    /* LDX */                                               \
+    X(0xA2, handle_LDX_IM,   "LDX", Immediate,   2, 0)      \
+    X(0xA6, handle_LDX_ZP,   "LDX", ZeroPage,    3, 0)      \
+    X(0xB6, handle_LDX_ZPY,  "LDX", ZeroPageY,   4, 0)      \
+    X(0xAE, handle_LDX_ABS,  "LDX", Absolute,    4, 0)      \
+    X(0xBE, handle_LDX_ABSY, "LDX", AbsoluteY,   4, 1)      \
+                                                            \
+    /* LDY */                                               \
+    X(0xA0, handle_LDY_IM,   "LDY", Immediate,   2, 0)      \
+    X(0xA4, handle_LDY_ZP,   "LDY", ZeroPage,    3, 0)      \
+    X(0xB4, handle_LDY_ZPX,  "LDY", ZeroPageX,   4, 0)      \
+    X(0xAC, handle_LDY_ABS,  "LDY", Absolute,    4, 0)      \
+    X(0xBC, handle_LDY_ABSX, "LDY", AbsoluteX,   4, 1)      \
+                                                            \
+    /* STA */                                               \
+    X(0x85, handle_STA_ZP,   "STA", ZeroPage,    3, 0)      \
+    X(0x95, handle_STA_ZPX,  "STA", ZeroPageX,   4, 0)      \
+    X(0x8D, handle_STA_ABS,  "STA", Absolute,    4, 0)      \
+    X(0x9D, handle_STA_ABSX, "STA", AbsoluteX,   5, 0)      \
+    X(0x99, handle_STA_ABSY, "STA", AbsoluteY,   5, 0)      \
+    X(0x81, handle_STA_INDX, "STA", IndirectX,   6, 0)      \
+    X(0x91, handle_STA_INDY, "STA", IndirectY,   6, 0)      \
+                                                            \
+    /* STX */                                               \
+    X(0x86, handle_STX_ZP,   "STX", ZeroPage,    3, 0)      \
+    X(0x96, handle_STX_ZPY,  "STX", ZeroPageY,   4, 0)      \
+    X(0x8E, handle_STX_ABS,  "STX", Absolute,    4, 0)      \
+                                                            \
+    /* STY */                                               \
+    X(0x84, handle_STY_ZP,   "STY", ZeroPage,    3, 0)      \
+    X(0x94, handle_STY_ZPX,  "STY", ZeroPageX,   4, 0)      \
+    X(0x8C, handle_STY_ABS,  "STY", Absolute,    4, 0)      \
+                                                            \
+    /* Register Transfers */                                \
+    X(0xAA, handle_TAX,      "TAX", Implied,     2, 0)      \
+    X(0xA8, handle_TAY,      "TAY", Implied,     2, 0)      \
+    X(0x8A, handle_TXA,      "TXA", Implied,     2, 0)      \
+    X(0x98, handle_TYA,      "TYA", Implied,     2, 0)      \
+                                                            \
+    /* Stack Operations */                                  \
+    X(0xBA, handle_TSX,      "TSX", Implied,     2, 0)      \
+    X(0x9A, handle_TXS,      "TXS", Implied,     2, 0)      \
+    X(0x48, handle_PHA,      "PHA", Implied,     3, 0)      \
+    X(0x08, handle_PHP,      "PHP", Implied,     3, 0)      \
+    X(0x68, handle_PLA,      "PLA", Implied,     4, 0)      \
+    X(0x28, handle_PLP,      "PLP", Implied,     4, 0)      \
+                                                            \
+    /* Logical */                                           \
+    /* AND */                                               \
+    X(0x29, handle_AND_IM,   "AND", Immediate,   2, 0)      \
+    X(0x25, handle_AND_ZP,   "AND", ZeroPage,    3, 0)      \
+    X(0x35, handle_AND_ZPX,  "AND", ZeroPageX,   4, 0)      \
+    X(0x2D, handle_AND_ABS,  "AND", Absolute,    4, 0)      \
+    X(0x3D, handle_AND_ABSX, "AND", AbsoluteX,   4, 1)      \
+    X(0x39, handle_AND_ABSY, "AND", AbsoluteY,   4, 1)      \
+    X(0x21, handle_AND_INDX, "AND", IndirectX,   6, 0)      \
+    X(0x31, handle_AND_INDY, "AND", IndirectY,   5, 1)      \
+                                                            \
+    /* EOR */                                               \
+    X(0x49, handle_EOR_IM,   "EOR", Immediate,   2, 0)      \
+    X(0x45, handle_EOR_ZP,   "EOR", ZeroPage,    3, 0)      \
+    X(0x55, handle_EOR_ZPX,  "EOR", ZeroPageX,   4, 0)      \
+    X(0x4D, handle_EOR_ABS,  "EOR", Absolute,    4, 0)      \
+    X(0x5D, handle_EOR_ABSX, "EOR", AbsoluteX,   4, 1)      \
+    X(0x59, handle_EOR_ABSY, "EOR", AbsoluteY,   4, 1)      \
+    X(0x41, handle_EOR_INDX, "EOR", IndirectX,   6, 0)      \
+    X(0x51, handle_EOR_INDY, "EOR", IndirectY,   5, 1)      \
+                                                            \
+    /* IOR */                                               \
+    X(0x09, handle_IOR_IM,   "ORA", Immediate,   2, 0)      \
+    X(0x05, handle_IOR_ZP,   "ORA", ZeroPage,    3, 0)      \
+    X(0x15, handle_IOR_ZPX,  "ORA", ZeroPageX,   4, 0)      \
+    X(0x0D, handle_IOR_ABS,  "ORA", Absolute,    4, 0)      \
+    X(0x1D, handle_IOR_ABSX, "ORA", AbsoluteX,   4, 1)      \
+    X(0x19, handle_IOR_ABSY, "ORA", AbsoluteY,   4, 1)      \
+    X(0x01, handle_IOR_INDX, "ORA", IndirectX,   6, 0)      \
+    X(0x11, handle_IOR_INDY, "ORA", IndirectY,   5, 1)      \
+                                                            \
+    /* Bit Test */                                          \
+    X(0x24, handle_BIT_ZP,   "BIT", ZeroPage,    3, 0)      \
+    X(0x2C, handle_BIT_ABS,  "BIT", Absolute,    4, 0)      \
+                                                            \
+    /* Arithmetic */                                        \
+    /* Addition */                                          \
+    X(0x69, handle_ADC_IM,   "ADC", Immediate,   2, 0)      \
+    X(0x65, handle_ADC_ZP,   "ADC", ZeroPage,    3, 0)      \
+    X(0x75, handle_ADC_ZPX,  "ADC", ZeroPageX,   4, 0)      \
+    X(0x6D, handle_ADC_ABS,  "ADC", Absolute,    4, 0)      \
+    X(0x7D, handle_ADC_ABSX, "ADC", AbsoluteX,   4, 1)      \
+    X(0x79, handle_ADC_ABSY, "ADC", AbsoluteY,   4, 1)      \
+    X(0x61, handle_ADC_INDX, "ADC", IndirectX,   6, 0)      \
+    X(0x71, handle_ADC_INDY, "ADC", IndirectY,   5, 1)      \
+                                                            \
+    /* Subtraction */                                       \
+    X(0xE9, handle_SBC_IM,   "SBC", Immediate,   2, 0)      \
+    X(0xE5, handle_SBC_ZP,   "SBC", ZeroPage,    3, 0)      \
+    X(0xF5, handle_SBC_ZPX,  "SBC", ZeroPageX,   4, 0)      \
+    X(0xED, handle_SBC_ABS,  "SBC", Absolute,    4, 0)      \
+    X(0xFD, handle_SBC_ABSX, "SBC", AbsoluteX,   4, 1)      \
+    X(0xF9, handle_SBC_ABSY, "SBC", AbsoluteY,   4, 1)      \
+    X(0xE1, handle_SBC_INDX, "SBC", IndirectX,   6, 0)      \
+    X(0xF1, handle_SBC_INDY, "SBC", IndirectY,   5, 1)      \
+                                                            \
+    /* Comparisons */                                       \
+    X(0xC9, handle_CMP_IM,   "CMP", Immediate,   2, 0)      \
+    X(0xC5, handle_CMP_ZP,   "CMP", ZeroPage,    3, 0)      \
+    X(0xD5, handle_CMP_ZPX,  "CMP", ZeroPageX,   4, 0)      \
+    X(0xCD, handle_CMP_ABS,  "CMP", Absolute,    4, 0)      \
+    X(0xDD, handle_CMP_ABSX, "CMP", AbsoluteX,   4, 1)      \
+    X(0xD9, handle_CMP_ABSY, "CMP", AbsoluteY,   4, 1)      \
+    X(0xC1, handle_CMP_INDX, "CMP", IndirectX,   6, 0)      \
+    X(0xD1, handle_CMP_INDY, "CMP", IndirectY,   5, 1)      \
+                                                            \
+    X(0xE0, handle_CPX_IM,   "CPX", Immediate,   2, 0)      \
+    X(0xE4, handle_CPX_ZP,   "CPX", ZeroPage,    3, 0)      \
+    X(0xEC, handle_CPX_ABS,  "CPX", Absolute,    4, 0)      \
+                                                            \
+    X(0xC0, handle_CPY_IM,   "CPY", Immediate,   2, 0)      \
+    X(0xC4, handle_CPY_ZP,   "CPY", ZeroPage,    3, 0)      \
+    X(0xCC, handle_CPY_ABS,  "CPY", Absolute,    4, 0)      \
+                                                            \
+    /* Increments and Decrements */                         \
+    X(0xE6, handle_INC_ZP,   "INC", ZeroPage,    5, 0)      \
+    X(0xF6, handle_INC_ZPX,  "INC", ZeroPageX,   6, 0)      \
+    X(0xEE, handle_INC_ABS,  "INC", Absolute,    6, 0)      \
+    X(0xFE, handle_INC_ABSX, "INC", AbsoluteX,   7, 0)      \
+    X(0xE8, handle_INX,      "INX", Implied,     2, 0)      \
+    X(0xC8, handle_INY,      "INY", Implied,     2, 0)      \
+    X(0xC6, handle_DEC_ZP,   "DEC", ZeroPage,    5, 0)      \
+    X(0xD6, handle_DEC_ZPX,  "DEC", ZeroPageX,   6, 0)      \
+    X(0xCE, handle_DEC_ABS,  "DEC", Absolute,    6, 0)      \
+    X(0xDE, handle_DEC_ABSX, "DEC", AbsoluteX,   7, 0)      \
+    X(0xCA, handle_DEX,      "DEX", Implied,     2, 0)      \
+    X(0x88, handle_DEY,      "DEY", Implied,     2, 0)      \
+                                                            \
+    /* Shifts */                                            \
+    /* Arithmetic Shift Left */                             \
+    X(0x0A, handle_ASL,      "ASL", Accumulator, 2, 0)      \
+    X(0x06, handle_ASL_ZP,   "ASL", ZeroPage,    5, 0)      \
+    X(0x16, handle_ASL_ZPX,  "ASL", ZeroPageX,   6, 0)      \
+    X(0x0E, handle_ASL_ABS,  "ASL", Absolute,    6, 0)      \
+    X(0x1E, handle_ASL_ABSX, "ASL", AbsoluteX,   7, 0)      \
+                                                            \
+    /* Logical Shift Right */                               \
+    X(0x4A, handle_LSR,      "LSR", Accumulator, 2, 0)      \
+    X(0x46, handle_LSR_ZP,   "LSR", ZeroPage,    5, 0)      \
+    X(0x56, handle_LSR_ZPX,  "LSR", ZeroPageX,   6, 0)      \
+    X(0x4E, handle_LSR_ABS,  "LSR", Absolute,    6, 0)      \
+    X(0x5E, handle_LSR_ABSX, "LSR", AbsoluteX,   7, 0)      \
+                                                            \
+    /* Rotate Left */                                       \
+    X(0x2A, handle_ROL,      "ROL", Accumulator, 2, 0)      \
+    X(0x26, handle_ROL_ZP,   "ROL", ZeroPage,    5, 0)      \
+    X(0x36, handle_ROL_ZPX,  "ROL", ZeroPageX,   6, 0)      \
+    X(0x2E, handle_ROL_ABS,  "ROL", Absolute,    6, 0)      \
+    X(0x3E, handle_ROL_ABSX, "ROL", AbsoluteX,   7, 0)      \
+                                                            \
+    /* Rotate Right */                                      \
+    X(0x6A, handle_ROR,      "ROR", Accumulator, 2, 0)      \
+    X(0x66, handle_ROR_ZP,   "ROR", ZeroPage,    5, 0)      \
+    X(0x76, handle_ROR_ZPX,  "ROR", ZeroPageX,   6, 0)      \
+    X(0x6E, handle_ROR_ABS,  "ROR", Absolute,    6, 0)      \
+    X(0x7E, handle_ROR_ABSX, "ROR", AbsoluteX,   7, 0)      \
+                                                            \
+    /* Jumps and Calls */                                   \
+    X(0x4C, handle_JMP_ABS,  "JMP", Absolute,    3, 0)      \
+    X(0x6C, handle_JMP_IND,  "JMP", Indirect,    5, 0)      \
+    X(0x20, handle_JSR,      "JSR", Absolute,    6, 0)      \
+    X(0x60, handle_RTS,      "RTS", Implied,     6, 0)      \
+                                                            \
+    /* Branches */                                          \
+    X(0x90, handle_BCC,      "BCC", Relative,    2, 1)      \
+    X(0xB0, handle_BCS,      "BCS", Relative,    2, 1)      \
+    X(0xF0, handle_BEQ,      "BEQ", Relative,    2, 1)      \
+    X(0x30, handle_BMI,      "BMI", Relative,    2, 1)      \
+    X(0xD0, handle_BNE,      "BNE", Relative,    2, 1)      \
+    X(0x10, handle_BPL,      "BPL", Relative,    2, 1)      \
+    X(0x50, handle_BVC,      "BVC", Relative,    2, 1)      \
+    X(0x70, handle_BVS,      "BVS", Relative,    2, 1)      \
+                                                            \
+    /* Status Flag Changes */                               \
+    X(0x18, handle_CLC,      "CLC", Implied,     2, 0)      \
+    X(0xD8, handle_CLD,      "CLD", Implied,     2, 0)      \
+    X(0x58, handle_CLI,      "CLI", Implied,     2, 0)      \
+    X(0xB8, handle_CLV,      "CLV", Implied,     2, 0)      \
+    X(0x38, handle_SEC,      "SEC", Implied,     2, 0)      \
+    X(0xF8, handle_SED,      "SED", Implied,     2, 0)      \
+    X(0x78, handle_SEI,      "SEI", Implied,     2, 0)      \
+                                                            \
+    /* System Functions */                                  \
+    X(0x00, handle_BRK,      "BRK", Implied,     7, 0)      \
+    X(0xEA, handle_NOP,      "NOP", Implied,     2, 0)      \
+    X(0x40, handle_RTI,      "RTI", Implied,     6, 0)
+
+    // Builds the opcode descriptions from EMULATOR_6502_OPCODES
+    constexpr std::array<OpcodeInfo, OPCODE_COUNT> makeOpcodeTable() {
+        std::array<OpcodeInfo, OPCODE_COUNT> table{};
+        #define EMULATOR_6502_OPCODE_INFO(opcode, handler, mnemonic, mode, cycles, penalty) \
+            table[opcode] = { mnemonic, AddressingMode::mode, cycles, penalty, handler };
+        EMULATOR_6502_OPCODES(EMULATOR_6502_OPCODE_INFO)
+        #undef EMULATOR_6502_OPCODE_INFO
+        return table;
+    }
+
+    inline constexpr std::array<OpcodeInfo, OPCODE_COUNT> opcode_table = makeOpcodeTable();
+
+    // Handlers only, indexed by opcode. nullptr for opcodes that are not implemented
+    constexpr std::array<InstructionHandler, OPCODE_COUNT> makeDispatchTable() {
+        std::array<InstructionHandler, OPCODE_COUNT> table{};
+        for (int opcode = 0; opcode < OPCODE_COUNT; opcode++) {
+            table[opcode] = opcode_table[opcode].handler;
+        }
+        return table;
+    }
+
+    inline constexpr std::array<InstructionHandler, OPCODE_COUNT> dispatch_table = makeDispatchTable();
+
+    // Whether each opcode can be part of a loop execute() fast-forwards as idle: it only reads memory,
+    // does not change PC and settles after a pass or two. Picked by handler, so ORA abs,X / abs,Y are
+    // left out as their handlers are EOR's, and transfers as transferRegister goes through memory
+    constexpr std::array<bool, OPCODE_COUNT> makeIdleLoopTable() {
+        constexpr InstructionHandler idle[] = {
+            handle_LDA_IM, handle_LDA_ZP, handle_LDA_ZPX, handle_LDA_ABS, handle_LDA_ABSX, handle_LDA_ABSY,
+            handle_LDX_IM, handle_LDX_ZP, handle_LDX_ZPY, handle_LDX_ABS, handle_LDX_ABSY,
+            handle_LDY_IM, handle_LDY_ZP, handle_LDY_ZPX, handle_LDY_ABS, handle_LDY_ABSX,
+            handle_AND_IM, handle_AND_ZP, handle_AND_ZPX, handle_AND_ABS, handle_AND_ABSX, handle_AND_ABSY,
+            handle_IOR_IM, handle_IOR_ZP, handle_IOR_ZPX, handle_IOR_ABS,
+            handle_BIT_ZP, handle_BIT_ABS,
+            handle_CMP_IM, handle_CMP_ZP, handle_CMP_ZPX, handle_CMP_ABS, handle_CMP_ABSX, handle_CMP_ABSY,
+            handle_CPX_IM, handle_CPX_ZP, handle_CPX_ABS,
+            handle_CPY_IM, handle_CPY_ZP, handle_CPY_ABS,
+            handle_CLC, handle_CLD, handle_CLI, handle_CLV, handle_SEC, handle_SED, handle_SEI, handle_NOP
+        };
+        std::array<bool, OPCODE_COUNT> table{};
+        for (int opcode = 0; opcode < OPCODE_COUNT; opcode++) {
+            for (InstructionHandler handler : idle) {
+                table[opcode] = table[opcode] || (opcode_table[opcode].handler == handler);
+            }
+        }
+        return table;
+    }
+
+    inline constexpr std::array<bool, OPCODE_COUNT> idle_loop_table = makeIdleLoopTable();
+
 };
 
 class InvalidInstructionException : public std::exception {
@@ -0,0 +1,70 @@
+//
+// Loading program and ROM images from disk, mapped once and shared between machines
+//
+
+#ifndef IMAGE_LOADER_H
+#define IMAGE_LOADER_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "emulator_6502.h"
+
+namespace emulator_6502 {
+
+    enum class ImageFormat {
+        Auto,       // From the extension: .hex / .ihx are Intel HEX, .prg is PRG, anything else is raw
+        Raw,        // The bytes as they are, loaded at the address passed to load()
+        IntelHex,   // Text records, the image covers the lowest to the highest address written
+        PRG         // Little endian load address in the first 2 bytes, then the bytes
+    };
+
+    // A program or ROM image read from disk once. Raw and PRG files are memory mapped, so any number
+    // of machines can map the same image as ROM without copying it
+    class ProgramImage : public std::enable_shared_from_this<ProgramImage> {
+    public:
+        // Throws std::runtime_error if the file cannot be read or is not a valid image
+        // load_address is only used for raw images, the other formats carry their own
+        static std::shared_ptr<const ProgramImage> load(const std::string& path,
+                                                        ImageFormat format = ImageFormat::Auto,
+                                                        Word load_address = 0);
+
+        ProgramImage(const ProgramImage&) = delete;
+        ProgramImage& operator=(const ProgramImage&) = delete;
+        ~ProgramImage();
+
+        [[nodiscard]] Word loadAddress() const { return load_address; }
+        [[nodiscard]] size_t size() const { return length; }
+        [[nodiscard]] const Byte* bytes() const { return start; }
+
+        // Maps the image read only at its load address, or the one given, through memory.bus
+        // The address must be page aligned, a partial last page reads as 0x00 past the end of the image.
+        // The mapped pages share ownership of the image, so it stays loaded while any bus or fork maps it
+        void mapROM(Memory& memory) const;
+        void mapROM(Memory& memory, Word address) const;
+
+        // Copies the image into memory at its load address, or the one given
+        void copyTo(Memory& memory) const;
+        void copyTo(Memory& memory, Word address) const;
+
+    private:
+        ProgramImage() = default;
+
+        // Start of the image, readable up to the next 256 byte boundary past its end
+        const Byte* start = nullptr;
+        size_t length = 0;
+        Word load_address = 0;
+
+        // Either the file mapping or a padded copy backs 'start'
+        void* mapping = nullptr;
+        size_t mapping_size = 0;
+        std::vector<Byte> owned;
+
+        void useBytes(const Byte* bytes, size_t size);
+    };
+
+}
+
+#endif //IMAGE_LOADER_H
@@ -0,0 +1,114 @@
+//
+// Binary trace of executed instructions kept in a fixed size ring buffer
+//
+
+#ifndef INSTRUCTION_TRACE_H
+#define INSTRUCTION_TRACE_H
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "emulator_6502.h"
+
+namespace emulator_6502 {
+
+    using u64 = uint64_t;
+
+    // The CPU state just before one instruction ran
+    struct TraceRecord {
+        u64 cycle;          // Cycles run under the trace before this instruction
+        Word pc;
+        Byte opcode;
+        Byte operands[2];   // The two bytes after the opcode, opcode_table says how many are used
+        Byte a;
+        Byte x;
+        Byte y;
+        Byte sp;
+        Byte p;             // Packed status flags (as pushed by PHP)
+    };
+
+    // Single producer, single consumer ring of TraceRecords. The CPU thread records, any one other
+    // thread drains. Recording never blocks or allocates: when the ring is full the oldest records are
+    // overwritten and counted as dropped the next time the ring is drained
+    //
+    // Attach with cpu.trace = &trace. While cpu.trace is nullptr execute runs a loop with no trace code
+    class InstructionTrace {
+    public:
+        // capacity is rounded up to a power of two
+        explicit InstructionTrace(size_t capacity = 1 << 16);
+
+        // *** Producer (the thread running the CPU) ***
+        void record(const CPU& cpu, const Memory& memory, u64 cycle) {
+            // Built in registers and stored in one go, byte stores straight into the ring would make
+            // the compiler reload everything after each one
+            TraceRecord entry;
+            entry.cycle = cycle;
+            entry.pc = cpu.PC;
+
+            // The instruction is nearly always within one RAM / ROM page
+            const Byte* page = memory.bus.readPage(cpu.PC);
+            if (page && (cpu.PC & 0xFF) <= 0xFD) {
+                const Byte* bytes = page + (cpu.PC & 0xFF);
+                entry.opcode = bytes[0];
+                entry.operands[0] = bytes[1];
+                entry.operands[1] = bytes[2];
+            } else {
+                entry.opcode = memory.bus.peek(cpu.PC);
+                entry.operands[0] = memory.bus.peek(cpu.PC + 1);
+                entry.operands[1] = memory.bus.peek(cpu.PC + 2);
+            }
+
+            entry.a = cpu.Accumulator;
+            entry.x = cpu.X_reg;
+            entry.y = cpu.Y_reg;
+            entry.sp = cpu.SP;
+            // Packed when the record is copied out, not here
+            std::memcpy(&entry.p, &cpu.flags, sizeof(entry.p));
+
+            u64 index = head.load(std::memory_order_relaxed);
+            records[index & mask] = entry;
+            head.store(index + 1, std::memory_order_release);
+        }
+
+        // Cycle stamp the next execute call starts from, moved on by the cycles each call runs
+        [[nodiscard]] u64 cycles() const { return cycle_count; }
+        void advance(u64 cycles) { cycle_count += cycles; }
+
+        // *** Consumer (any one thread) ***
+        // Copies up to 'max' of the oldest records not yet drained, returns how many were copied
+        size_t drain(TraceRecord* out, size_t max);
+        // Drains everything pending to the file as raw TraceRecords, returns how many were written
+        size_t drainTo(std::FILE* file);
+        // Records lost because the producer lapped the consumer
+        [[nodiscard]] u64 dropped() const { return dropped_count; }
+
+        // Copies the newest 'count' records, oldest first, without draining them. Meant for crash
+        // reports once the CPU has stopped
+        size_t last(TraceRecord* out, size_t count) const;
+
+        [[nodiscard]] size_t capacity() const { return mask + 1; }
+        [[nodiscard]] u64 recorded() const { return head.load(std::memory_order_acquire); }
+
+        // One line disassembly with the registers, e.g. "8002  A9 12     LDA  A:00 X:00 Y:00 P:24 SP:FF  CYC:2"
+        static std::string format(const TraceRecord& record);
+
+    private:
+        std::unique_ptr<TraceRecord[]> records;
+        size_t mask;
+        u64 cycle_count = 0;
+
+        // Written by the producer, read by the consumer, kept off the consumer's cache line
+        alignas(64) std::atomic<u64> head{0};
+        alignas(64) u64 tail = 0;
+        u64 dropped_count = 0;
+
+        size_t copyFrom(u64 first, u64 end, TraceRecord* out) const;
+        static void packFlags(TraceRecord* out, size_t count);
+    };
+
+}
+
+#endif //INSTRUCTION_TRACE_H
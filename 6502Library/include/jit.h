@@ -0,0 +1,147 @@
+//
+// Basic block translator to x86-64 machine code, used by the JIT core
+//
+
+#ifndef JIT_H
+#define JIT_H
+
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "emulator_6502.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+    #define EMULATOR_6502_JIT 1
+#else
+    #define EMULATOR_6502_JIT 0
+#endif
+
+namespace emulator_6502 {
+
+    // What a translated block did, returned in a single register
+    struct JitExit {
+        s32 cycles;
+        u32 instructions;
+    };
+
+    // Runs with 'budget' as the execute budget left, clock_budget is only brought up to date around
+    // calls out of the block. The cycles and instructions returned include the blocks chained to
+    using JitCode = JitExit (*)(CPU* cpu, Memory* memory, Byte* const* read_map, s32 budget);
+
+    struct JitBlock {
+        JitCode code = nullptr;     // nullptr when the first instruction is not a valid opcode
+        Word start = 0;
+        u32 length = 0;             // Guest bytes covered
+        u32 instructions = 0;
+        // The block runs only while the budget is above this, the cycles of every instruction but the last.
+        // The interpreter checks the budget before each instruction, so the block then stops where it would
+        s32 guard = 0;
+    };
+
+    // Translates runs of straight line code ending at a branch, JMP, JSR, RTS, RTI or BRK into host code
+    //
+    // Loads and stores in the immediate, zero page, indexed zero page and indexed absolute modes,
+    // logic ops, ADC / SBC, compares, BIT, shifts, INC / DEC, register steps, transfers, flag
+    // instructions, PHA / PHP / PLA / PLP, branches, JMP, JSR and RTS are emitted directly. Every other valid opcode calls its handler
+    // from inside the block, so only invalid opcodes end a block early. Cycles, flags and page crossing
+    // penalties follow the handlers, including where they differ from a real 6502, and the cycles
+    // charged come from running each handler once before the first translation
+    //
+    // A, X, Y and P live in host registers for the whole block, memory goes through the bus's read_map /
+    // write_map with the slow path called for the rest, device pages included. A block that ends where
+    // another one starts jumps straight into it, after the same budget and poll checks runJit makes,
+    // so hot loops and calls stay in host code until the budget runs out. Self loops that could be idle
+    // return instead, for execute() to skip
+    //
+    // Owned by the bus, like DecodedCache, and invalidated a page at a time the same way. A block that
+    // writes to a code page exits straight after that instruction, since it may have just rewritten itself
+    class JitCache {
+    public:
+        JitCache();
+        ~JitCache();
+        JitCache(const JitCache&) = delete;
+        JitCache& operator=(const JitCache&) = delete;
+
+        // False where there is no backend, the JIT core then runs the switch core instead
+        static constexpr bool supported() { return EMULATOR_6502_JIT != 0; }
+
+        // The block starting at pc, translated on the first visit
+        const JitBlock& lookup(Word pc, Bus& bus) {
+            const Table* table = tables[pc >> 8].get();
+            if (table) {
+                const JitBlock* block = table->blocks[pc & 0xFF];
+                if (block) {
+                    return *block;
+                }
+            }
+            return translate(pc, bus);
+        }
+
+        // Forgets the blocks that read from the page. Their code stays in place until the next flush,
+        // so a block that invalidates itself can still return
+        void invalidatePage(u32 index);
+        void clear();
+
+        [[nodiscard]] u64 translations() const { return translation_count; }
+        [[nodiscard]] u64 invalidations() const { return invalidation_count; }
+        [[nodiscard]] u64 flushes() const { return flush_count; }
+
+    private:
+        struct Table {
+            std::array<const JitBlock*, Bus::PAGE_SIZE> blocks{};
+        };
+
+        std::array<std::unique_ptr<Table>, Bus::PAGE_COUNT> tables;
+        std::array<std::vector<Word>, Bus::PAGE_COUNT> page_blocks;    // Block starts with bytes on each page
+        std::vector<std::unique_ptr<JitBlock>> blocks;
+        // Where blocks chain into the block at each address, nullptr when there is none
+        std::unique_ptr<Byte*[]> entries;
+
+        Byte* code = nullptr;       // Executable arena, emptied when full
+        size_t code_size = 0;
+        size_t code_used = 0;
+
+        u64 translation_count = 0;
+        u64 invalidation_count = 0;
+        u64 flush_count = 0;
+
+        const JitBlock& translate(Word pc, Bus& bus);
+        Byte* place(const std::vector<Byte>& bytes);
+        void flush();
+    };
+
+    class JitMismatchException : public std::exception {
+        std::string message;
+
+    public:
+        explicit JitMismatchException(std::string message) : message(std::move(message)) {}
+
+        [[nodiscard]] const char* what() const noexcept override {
+            return message.c_str();
+        }
+    };
+
+    // Replays everything the JIT core runs on an interpreted copy of the machine and compares the two
+    // after every block. Devices are not copied and interrupts are not replayed, so only use it on
+    // machines with RAM and ROM and nothing raising IRQ or NMI
+    class JitVerifier {
+    public:
+        JitVerifier(const CPU& cpu, const Memory& memory);
+        ~JitVerifier();
+
+        // Steps the copy by 'instructions' and throws JitMismatchException if registers, flags, PC,
+        // cycles or memory differ
+        void check(const CPU& cpu, const Memory& memory, u32 instructions, s32 cycles, Word block_start);
+
+    private:
+        CPU shadow_cpu;
+        std::unique_ptr<Memory> shadow_memory;
+        std::unique_ptr<Byte[]> expected;
+        std::unique_ptr<Byte[]> actual;
+    };
+
+}
+
+#endif //JIT_H
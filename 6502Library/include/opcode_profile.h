@@ -0,0 +1,78 @@
+//
+// Per opcode execution and cycle counts
+//
+
+#ifndef OPCODE_PROFILE_H
+#define OPCODE_PROFILE_H
+
+#include <array>
+#include <ostream>
+#include <vector>
+
+#include "emulator_6502.h"
+
+namespace emulator_6502 {
+
+    // Counters indexed by opcode, the same way as dispatch_table
+    // Attach with cpu.profile = &profile, counts keep adding up across execute calls until reset()
+    struct OpcodeProfile {
+        std::array<u64, 256> executions{};
+        std::array<u64, 256> cycles{};
+        std::array<u64, 256> page_crosses{};        // Page crossing penalties charged
+        std::array<u64, 256> branches_taken{};
+        std::array<u64, 256> branches_not_taken{};
+        // Consecutive opcodes, indexed by first << 8 | second. This is what picks the superinstructions
+        // the decoded core fuses
+        std::vector<u64> pairs = std::vector<u64>(256 * 256);
+
+        struct Pair {
+            Byte first;
+            Byte second;
+            u64 executions;
+        };
+
+        // Called by execute around each instruction
+        void begin(const CPU& cpu) {
+            page_crossings_before = cpu.page_crossings;
+            branches_taken_before = cpu.branches_taken;
+        }
+
+        void end(const CPU& cpu, Byte opcode, s32 cycles_used) {
+            executions[opcode]++;
+            if (has_previous) {
+                pairs[previous_opcode << 8 | opcode]++;
+            }
+            previous_opcode = opcode;
+            has_previous = true;
+            cycles[opcode] += cycles_used;
+            page_crosses[opcode] += cpu.page_crossings - page_crossings_before;
+            if (opcode_table[opcode].mode == AddressingMode::Relative) {
+                if (cpu.branches_taken != branches_taken_before) {
+                    branches_taken[opcode]++;
+                } else {
+                    branches_not_taken[opcode]++;
+                }
+            }
+        }
+
+        void reset();
+        [[nodiscard]] u64 totalExecutions() const;
+        [[nodiscard]] u64 totalCycles() const;
+        // The most frequent pairs, most frequent first
+        [[nodiscard]] std::vector<Pair> hottestPairs(size_t count) const;
+
+        // One row / object per opcode that ran, with its mnemonic and addressing mode. The JSON also
+        // lists the 16 hottest pairs
+        void writeCsv(std::ostream& out) const;
+        void writeJson(std::ostream& out) const;
+
+    private:
+        u64 page_crossings_before = 0;
+        u64 branches_taken_before = 0;
+        u32 previous_opcode = 0;
+        bool has_previous = false;
+    };
+
+}
+
+#endif //OPCODE_PROFILE_H
@@ -0,0 +1,60 @@
+//
+// Runs a CPU at a fixed clock rate against the host's wall clock
+//
+
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+#include "emulator_6502.h"
+
+namespace emulator_6502 {
+
+    struct RealtimeOptions {
+        // Host time each batch of cycles covers. The CPU runs a batch flat out and then sleeps until the
+        // next one is due, so shorter batches mean finer pacing and more wake-ups
+        std::chrono::microseconds batch{10'000};
+        // Stops after this many cycles, 0 runs until 'stop' or 'after_batch' says otherwise
+        u64 cycles = 0;
+        // Checked once a batch, can be set from another thread
+        const std::atomic<bool>* stop = nullptr;
+        // Called after every batch, returning true stops. A good place to present a frame or poll input
+        std::function<bool(CPU&, Memory&)> after_batch;
+        // Once the host is this far behind, for example after being suspended, the missed time is dropped
+        // instead of being made up in one long burst
+        std::chrono::microseconds max_lag{100'000};
+    };
+
+    struct RealtimeStats {
+        u64 cycles = 0;             // Run, overshoot included
+        u64 batches = 0;
+        u64 resyncs = 0;            // Times max_lag was exceeded and the schedule restarted
+        double seconds = 0.0;       // Host time from the start until the last batch's slot ended
+        double busy_seconds = 0.0;  // Host time spent inside execute and after_batch
+
+        // How late each batch started against its schedule, in microseconds
+        double jitter_mean_us = 0.0;
+        double jitter_stddev_us = 0.0;
+        double jitter_max_us = 0.0;
+
+        [[nodiscard]] double effectiveHz() const { return seconds > 0 ? cycles / seconds : 0.0; }
+        // Share of one host core the emulation used, sleeping excluded
+        [[nodiscard]] double load() const { return seconds > 0 ? busy_seconds / seconds : 0.0; }
+    };
+
+    // Runs cpu.execute in batches paced to 'hz' cycles per second of host time
+    //
+    // Batches are due at fixed points from the start and each one runs the cycles that bring the total
+    // up to hz times the time elapsed on that schedule, so late wake-ups and instruction overshoot are made
+    // up by the next batch instead of adding up as drift. The host clock is read twice per batch and never
+    // per instruction, and the thread sleeps on an absolute deadline between batches
+    //
+    // Throws std::invalid_argument if 'hz' is not a finite rate above 0
+    RealtimeStats runRealtime(CPU& cpu, Memory& memory, double hz, const RealtimeOptions& options = {});
+
+}
+
+#endif //REALTIME_H
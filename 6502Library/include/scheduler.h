@@ -0,0 +1,76 @@
+//
+// Events posted at future cycles, run by execute between instructions
+//
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <functional>
+#include <limits>
+#include <unordered_set>
+#include <vector>
+
+#include "emulator_6502.h"
+
+namespace emulator_6502 {
+
+    // A min-heap of events keyed by cycle. Attach with cpu.scheduler = &scheduler, execute then works
+    // out how much budget is left before the earliest event and only looks at the scheduler again once
+    // it has been used, so nothing is polled per instruction or per cycle
+    //
+    // Time is counted in the units of the timing policy execute runs with: cycles for Exact and Fast,
+    // instructions for Instructions. An event runs at the first instruction boundary at or after its
+    // cycle, events due on the same cycle run in the order they were posted
+    //
+    // While execute is running now() is only moved on when the scheduler is looked at, so devices work
+    // out times from cpu.cycle() and call cpu.pollSoon() after posting an event from a register access
+    class Scheduler {
+    public:
+        using EventId = u64;
+        // Called with the cycle the event was due on, which is also what now() returns meanwhile,
+        // so an event that posts the next one from it keeps exact time
+        using Callback = std::function<void(u64 cycle)>;
+
+        static constexpr u64 NO_EVENT = std::numeric_limits<u64>::max();
+
+        EventId schedule(u64 cycle, Callback callback);
+        EventId scheduleIn(u64 delay, Callback callback) { return schedule(now_cycle + delay, std::move(callback)); }
+        // False when the event has already run or was cancelled before
+        bool cancel(EventId id);
+        void clear();
+
+        [[nodiscard]] u64 now() const { return now_cycle; }
+        // Cycle of the earliest event, NO_EVENT when there are none
+        [[nodiscard]] u64 nextDeadline() const { return events.empty() ? NO_EVENT : events.front().cycle; }
+        [[nodiscard]] size_t pending() const { return events.size() - cancelled.size(); }
+
+        // Runs every event due at or before 'cycle' in order, then moves the clock to 'cycle'
+        void runUntil(u64 cycle);
+        // Moves the clock forward without running anything, used by execute once its budget is spent
+        void advanceTo(u64 cycle);
+
+    private:
+        struct Event {
+            u64 cycle;
+            EventId id;
+            Callback callback;
+        };
+
+        // Earliest cycle at the front, ties in posting order
+        struct Later {
+            bool operator()(const Event& a, const Event& b) const {
+                return a.cycle != b.cycle ? a.cycle > b.cycle : a.id > b.id;
+            }
+        };
+
+        std::vector<Event> events;
+        std::unordered_set<EventId> cancelled;  // Still in the heap, dropped when they reach the front
+        u64 now_cycle = 0;
+        EventId next_id = 1;
+
+        void dropCancelled();
+    };
+
+}
+
+#endif //SCHEDULER_H
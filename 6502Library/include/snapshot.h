@@ -0,0 +1,45 @@
+//
+// Saving and restoring the full machine state as a compact binary blob
+//
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <cstddef>
+#include <vector>
+
+#include "emulator_6502.h"
+
+namespace emulator_6502 {
+
+    // Blob layout, all values little endian:
+    //   0  char[4]  magic "65SN"
+    //   4  u16      version
+    //   6  u16      header size (offset of the memory image)
+    //   8  u16      PC
+    //  10  u8       SP, A, X, Y, P (packed status flags)
+    //  15  u8       interrupt lines, bit 0 is nmi_pending
+    //  16  u64      cycle()
+    //  24  u64      carried_cycles
+    //  32  u32      irq_sources
+    //  36  u8[64K]  memory as the CPU sees it (Memory::copyOut)
+    static constexpr u32 SNAPSHOT_VERSION = 2;
+    static constexpr size_t SNAPSHOT_HEADER_SIZE = 36;
+    static constexpr size_t SNAPSHOT_SIZE = SNAPSHOT_HEADER_SIZE + Memory::MAX_MEMORY;
+
+    // Writes the state into a caller provided buffer without allocating
+    // Returns the number of bytes written, or 0 if the buffer is smaller than SNAPSHOT_SIZE
+    size_t saveState(const CPU& cpu, const Memory& memory, Byte* buffer, size_t size);
+
+    // Writes the state into a new buffer
+    std::vector<Byte> saveState(const CPU& cpu, const Memory& memory);
+
+    // Restores a state written by saveState, the clock included, so the next execute or executeCycles
+    // carries on where the saved one stopped. Not for use while execute is running. Returns false,
+    // leaving cpu and memory untouched, if the blob is truncated or was written by an unknown version
+    bool loadState(CPU& cpu, Memory& memory, const Byte* buffer, size_t size);
+    bool loadState(CPU& cpu, Memory& memory, const std::vector<Byte>& buffer);
+
+}
+
+#endif //SNAPSHOT_H
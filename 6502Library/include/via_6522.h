@@ -0,0 +1,107 @@
+//
+// MOS 6522 Versatile Interface Adapter: two 8-bit ports and two 16-bit timers
+//
+
+#ifndef VIA_6522_H
+#define VIA_6522_H
+
+#include <functional>
+
+#include "clocked_device.h"
+
+namespace emulator_6502 {
+
+    // Map it with memory.bus.mapDevice, the registers repeat every 16 bytes across the page
+    //
+    // The counters are caught up when a register is read or written and the time-outs are scheduler
+    // events, see clocked_device.h. Accesses are timed at the start of the instruction making them.
+    // The IRQ output drives cpu.setIRQ with its own source bit
+    //
+    // Not modelled: the shift register shifts nothing, CA2 / CB2 handshaking and the pulses on PB6,
+    // so timer 2 stands still while it is set to count them
+    class Via6522 : public ClockedDevice {
+    public:
+        // Register select, the low four address bits
+        enum Register : Byte {
+            ORB, ORA, DDRB, DDRA,
+            T1C_L, T1C_H, T1L_L, T1L_H,
+            T2C_L, T2C_H, SR, ACR,
+            PCR, IFR, IER, ORA_NO_HANDSHAKE
+        };
+
+        // Interrupt flag / enable bits
+        static constexpr Byte
+            irq_ca2    = 0b00000001,
+            irq_ca1    = 0b00000010,
+            irq_sr     = 0b00000100,
+            irq_cb2    = 0b00001000,
+            irq_cb1    = 0b00010000,
+            irq_timer2 = 0b00100000,
+            irq_timer1 = 0b01000000,
+            irq_any    = 0b10000000;
+
+        Via6522(CPU& cpu, Scheduler& scheduler, u32 irq_source = 1);
+        ~Via6522() override;
+        Via6522(const Via6522&) = delete;
+        Via6522& operator=(const Via6522&) = delete;
+
+        // Levels on the pins set as inputs
+        void setPortAInput(Byte value) { input_a = value; }
+        void setPortBInput(Byte value) { input_b = value; }
+        // CA1 / CB1 set their flag on the edge PCR selects
+        void setCA1(bool level);
+        void setCB1(bool level);
+
+        // What the chip drives: the output register on output pins, the input level elsewhere
+        [[nodiscard]] Byte portA() const;
+        [[nodiscard]] Byte portB() const;
+        // Called with portA() / portB() when a register write changes it
+        std::function<void(Byte)> on_port_a;
+        std::function<void(Byte)> on_port_b;
+
+        // Counters as of cpu.cycle()
+        [[nodiscard]] Word timer1();
+        [[nodiscard]] Word timer2();
+
+    protected:
+        Byte readRegister(Word address) override;
+        void writeRegister(Word address, Byte value) override;
+        void catchUp(u64 cycles) override;
+
+    private:
+        u32 irq_source;
+
+        Byte ora = 0, orb = 0, ddra = 0, ddrb = 0;
+        Byte input_a = 0xFF, input_b = 0xFF;
+        bool ca1 = true, cb1 = true;
+        Byte sr = 0, acr = 0, pcr = 0, ifr = 0, ier = 0;
+        bool pb7 = true;                    // Timer 1 output on PB7 while ACR bit 7 is set
+
+        // Counters as of lastSync(). Free running timer 1 spends a cycle on -1, read as 0xFFFF, before
+        // it reloads from the latch
+        Word t1_latch = 0;
+        s32 t1_counter = 0;
+        bool t1_started = false;            // Written since power on, so free running time-outs are flagged
+        bool t1_armed = false;              // A one shot time-out that has not been flagged yet
+        Scheduler::EventId t1_event = 0;
+
+        Byte t2_latch_low = 0;
+        Word t2_counter = 0;
+        bool t2_armed = false;
+        Scheduler::EventId t2_event = 0;
+
+        [[nodiscard]] bool continuous() const { return acr & 0x40; }
+        [[nodiscard]] bool countingPulses() const { return acr & 0x20; }
+        void scheduleTimer1(u64 now);
+        void scheduleTimer2(u64 now);
+        void timer1Timeout(u64 cycle);
+        void timer2Timeout(u64 cycle);
+        void setFlags(Byte bits);
+        void clearFlags(Byte bits);
+        void updateIrq();
+        void portsChanged(Byte old_a, Byte old_b);
+    };
+
+}
+
+#endif //VIA_6522_H
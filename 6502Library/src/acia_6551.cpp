@@ -0,0 +1,244 @@
+//
+// MOS 6551 Asynchronous Communications Interface Adapter: a serial port
+//
+
+#include "../include/acia_6551.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <poll.h>
+#include <unistd.h>
+#define EMULATOR_6502_POSIX_IO 1
+#else
+#define EMULATOR_6502_POSIX_IO 0
+#endif
+
+using namespace emulator_6502;
+
+namespace {
+
+    // Bits 0-3 of the control register, 0 is the 16x external clock, taken as the usual 1.8432 MHz crystal
+    constexpr double BAUD_RATES[16] = {
+        115200, 50, 75, 109.92, 134.58, 150, 300, 600,
+        1200, 1800, 2400, 3600, 4800, 7200, 9600, 19200
+    };
+
+    constexpr size_t INPUT_LIMIT = 4096;        // Host input read ahead of the line
+    constexpr size_t OUTPUT_LIMIT = 4096;       // Buffered output that is written straight away
+    constexpr size_t WRITE_CHUNK = 512;         // Never more than PIPE_BUF, so a ready pipe takes it whole
+
+}
+
+Acia6551::Acia6551(CPU& cpu, Scheduler& scheduler, int input_fd, int output_fd, u32 irq_source)
+    : ClockedDevice(cpu, scheduler), input_fd(EMULATOR_6502_POSIX_IO ? input_fd : -1),
+      output_fd(EMULATOR_6502_POSIX_IO ? output_fd : -1), irq_source(irq_source) {}
+
+Acia6551::~Acia6551() {
+    cancel(tx_event);
+    cancel(rx_event);
+    cancel(flush_event);
+    if (tx_busy) {
+        output.push_back(static_cast<char>(tx_shift));
+        if (!(status & status_tx_empty)) {
+            output.push_back(static_cast<char>(tx_data));
+        }
+    }
+    writeOutput(true);
+    cpu.setIRQ(irq_source, false);
+}
+
+Byte Acia6551::readRegister(Word address) {
+    switch (address & 0x03) {
+        case DATA:
+            status &= ~(status_rx_full | status_overrun);
+            return rx_data;
+        case STATUS: {
+            Byte value = status;
+            status &= ~status_irq;
+            updateIrq();
+            return value;
+        }
+        case COMMAND:
+            return command;
+        default:    // CONTROL
+            return control;
+    }
+}
+
+void Acia6551::writeRegister(Word address, Byte value) {
+    u64 now = cpu.cycle();
+
+    switch (address & 0x03) {
+        case DATA:
+            tx_data = value;
+            status &= ~status_tx_empty;
+            if (!tx_busy) {
+                startTransmit(now);
+            }
+            break;
+        case STATUS:    // Programmed reset
+            command &= 0xE0;
+            status &= ~status_overrun;
+            break;
+        case COMMAND:
+            command = value;
+            scheduleReceive(now);
+            break;
+        default:    // CONTROL
+            control = value;
+            break;
+    }
+}
+
+void Acia6551::receive(const std::string& bytes) {
+    input.insert(input.end(), bytes.begin(), bytes.end());
+    scheduleReceive(cpu.cycle());
+}
+
+std::string Acia6551::takeOutput() {
+    std::string taken;
+    taken.swap(output);
+    return taken;
+}
+
+void Acia6551::flush() {
+    writeOutput(false);
+}
+
+// A start bit, the word, parity if enabled and the stop bits
+u64 Acia6551::characterCycles() const {
+    u32 bits = 1 + (8 - ((control >> 5) & 0x03)) + ((command & 0x20) ? 1 : 0) + ((control & 0x80) ? 2 : 1);
+    double cycles = static_cast<double>(clock_hz) * bits / BAUD_RATES[control & 0x0F];
+    return std::max<u64>(1, static_cast<u64>(cycles));
+}
+
+// Moves the data register into the shift register, which frees it straight away
+void Acia6551::startTransmit(u64 now) {
+    tx_busy = true;
+    status |= status_tx_empty;
+    if ((command & 0x0C) == 0x04) {
+        raiseIrq();
+    }
+
+    tx_shift = tx_data;
+    post(tx_event, now + characterCycles(), [this](u64 cycle) { transmitDone(cycle); });
+}
+
+void Acia6551::transmitDone(u64 cycle) {
+    tx_busy = false;
+    output.push_back(static_cast<char>(tx_shift));
+    if (!(status & status_tx_empty)) {
+        startTransmit(cycle);
+    }
+
+    if (output_fd < 0) {
+        return;
+    }
+    if (output.size() >= OUTPUT_LIMIT) {
+        writeOutput(false);
+    }
+    if (!output.empty() && !flush_event) {
+        post(flush_event, cycle + flush_interval, [this](u64 due) { flushTick(due); });
+    }
+}
+
+// Output the descriptor did not take is tried again later
+void Acia6551::flushTick(u64 cycle) {
+    writeOutput(false);
+    if (!output.empty()) {
+        post(flush_event, cycle + flush_interval, [this](u64 due) { flushTick(due); });
+    }
+}
+
+// Moves the next host character onto the line. While nothing is waiting the descriptor is only looked
+// at once a millisecond of guest time, or once a character if that is slower
+void Acia6551::receiveTick(u64 cycle) {
+    if (!enabled()) {
+        return;
+    }
+
+    if (input.size() < INPUT_LIMIT) {
+        pollInput();
+    }
+    if (!(status & status_rx_full) && !input.empty()) {
+        rx_data = input.front();
+        input.pop_front();
+        status |= status_rx_full;
+        if (!(command & 0x02)) {
+            raiseIrq();
+        }
+    }
+
+    if (!input.empty()) {
+        post(rx_event, cycle + characterCycles(), [this](u64 next) { receiveTick(next); });
+    } else if (input_fd >= 0) {
+        u64 idle = std::max(characterCycles(), clock_hz / 1000);
+        post(rx_event, cycle + idle, [this](u64 next) { receiveTick(next); });
+    }
+}
+
+void Acia6551::scheduleReceive(u64 now) {
+    if (rx_event || !enabled() || (input.empty() && input_fd < 0)) {
+        return;
+    }
+    post(rx_event, now + characterCycles(), [this](u64 cycle) { receiveTick(cycle); });
+}
+
+// Reads whatever the descriptor has ready. End of file or an error disconnects it
+void Acia6551::pollInput() {
+#if EMULATOR_6502_POSIX_IO
+    if (input_fd < 0) {
+        return;
+    }
+
+    pollfd ready{input_fd, POLLIN, 0};
+    if (::poll(&ready, 1, 0) <= 0 || !(ready.revents & (POLLIN | POLLHUP | POLLERR))) {
+        return;
+    }
+
+    Byte buffer[256];
+    ssize_t count = ::read(input_fd, buffer, sizeof(buffer));
+    if (count > 0) {
+        input.insert(input.end(), buffer, buffer + count);
+    } else if (count == 0 || (errno != EAGAIN && errno != EINTR)) {
+        input_fd = -1;
+    }
+#endif
+}
+
+// Writes buffered output while the descriptor is ready. With 'wait' it waits for it instead
+void Acia6551::writeOutput(bool wait) {
+#if EMULATOR_6502_POSIX_IO
+    while (output_fd >= 0 && !output.empty()) {
+        pollfd ready{output_fd, POLLOUT, 0};
+        int result = ::poll(&ready, 1, wait ? -1 : 0);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0 || !(ready.revents & POLLOUT)) {
+            return;
+        }
+
+        ssize_t count = ::write(output_fd, output.data(), std::min(output.size(), WRITE_CHUNK));
+        if (count > 0) {
+            output.erase(0, count);
+        } else if (count == 0 || (errno != EAGAIN && errno != EINTR)) {
+            output_fd = -1;
+        }
+    }
+#else
+    (void)wait;
+#endif
+}
+
+// Interrupts need DTR as well as the enable bit for the event
+void Acia6551::raiseIrq() {
+    if (enabled()) {
+        status |= status_irq;
+        updateIrq();
+    }
+}
+
+void Acia6551::updateIrq() {
+    cpu.setIRQ(irq_source, status & status_irq);
+}
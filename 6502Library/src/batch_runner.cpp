@@ -0,0 +1,144 @@
+//
+// Runs many independent CPU + Memory pairs across a pool of threads
+//
+
+#include "../include/batch_runner.h"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <mutex>
+
+using namespace emulator_6502;
+
+namespace {
+
+    // A worker's queue of job indices. The owner takes from the front, thieves take from the back
+    struct alignas(64) WorkQueue {
+        std::mutex mutex;
+        std::deque<size_t> jobs;
+
+        void push(size_t job) {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(job);
+        }
+
+        bool pop(size_t& job) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (jobs.empty()) {
+                return false;
+            }
+            job = jobs.front();
+            jobs.pop_front();
+            return true;
+        }
+
+        bool steal(size_t& job) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (jobs.empty()) {
+                return false;
+            }
+            job = jobs.back();
+            jobs.pop_back();
+            return true;
+        }
+    };
+
+    // Runs one slice of the job, returns true once the job is done. cycles_run counts the overshoot the
+    // CPU carries into its next slice, which that slice then runs short by
+    bool runSlice(BatchJob& job, s32 slice_cycles) {
+        u64 requested = job.cycles_run - std::min(job.cycles_run, job.cpu.carried_cycles);
+        u64 cycles = std::min<u64>(job.cycle_budget - requested, static_cast<u64>(slice_cycles));
+
+        try {
+            job.cycles_run += job.cpu.executeCycles(cycles, *job.memory);
+        } catch (const std::exception& e) {
+            job.status = BatchJob::Status::Faulted;
+            job.error = e.what();
+            return true;
+        }
+
+        if (job.cycles_run >= job.cycle_budget) {
+            job.status = BatchJob::Status::Finished;
+            return true;
+        }
+        return false;
+    }
+
+}
+
+// Builds a job from a raw image copied in at load_address, faults are reported without a memory dump
+BatchJob BatchJob::fromImage(const std::vector<Byte>& image, Word load_address, u64 cycle_budget) {
+    BatchJob job;
+    job.cycle_budget = cycle_budget;
+
+    Memory& memory = *job.memory;
+    std::vector<Byte> contents(Memory::MAX_MEMORY, 0x00);
+    size_t length = std::min<size_t>(image.size(), Memory::MAX_MEMORY - load_address);
+    std::copy_n(image.begin(), length, contents.begin() + load_address);
+    memory.copyIn(contents.data());
+
+    job.cpu.reset(memory);
+    job.cpu.invalid_opcode_dump = CPU::InvalidOpcodeDump::None;
+    return job;
+}
+
+BatchRunner::BatchRunner(unsigned thread_count, s32 slice_cycles)
+    : thread_count(std::max(1u, thread_count)), slice_cycles(std::max(1, slice_cycles)) {}
+
+// Runs every job until its budget is used or it faults
+void BatchRunner::run(std::vector<BatchJob>& jobs) const {
+    if (jobs.empty()) {
+        return;
+    }
+
+    const unsigned workers = std::min<size_t>(thread_count, jobs.size());
+    std::vector<WorkQueue> queues(workers);
+    std::atomic<size_t> unfinished{0};
+
+    // Deal the jobs out round robin
+    for (size_t i = 0; i < jobs.size(); i++) {
+        if (jobs[i].status != BatchJob::Status::Pending) {
+            continue;
+        }
+        if (jobs[i].cycles_run >= jobs[i].cycle_budget) {
+            jobs[i].status = BatchJob::Status::Finished;
+            continue;
+        }
+        queues[i % workers].jobs.push_back(i);
+        unfinished++;
+    }
+
+    auto worker = [&](unsigned id) {
+        while (unfinished.load(std::memory_order_acquire) > 0) {
+            size_t job = 0;
+            bool found = queues[id].pop(job);
+            for (unsigned offset = 1; !found && offset < workers; offset++) {
+                found = queues[(id + offset) % workers].steal(job);
+            }
+
+            if (!found) {
+                // Everything left is being run by other workers
+                std::this_thread::yield();
+                continue;
+            }
+
+            if (runSlice(jobs[job], slice_cycles)) {
+                unfinished.fetch_sub(1, std::memory_order_release);
+            } else {
+                queues[id].push(job);
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(workers - 1);
+    for (unsigned id = 1; id < workers; id++) {
+        threads.emplace_back(worker, id);
+    }
+    worker(0);
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
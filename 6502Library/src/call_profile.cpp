@@ -0,0 +1,149 @@
+//
+// Subroutine call graph profiler with inclusive and exclusive cycles
+//
+
+#include "../include/call_profile.h"
+
+#include <algorithm>
+#include <map>
+
+using namespace emulator_6502;
+
+CallProfile::CallProfile() {
+    reset();
+}
+
+void CallProfile::setSymbol(Word address, std::string name) {
+    symbols[address] = std::move(name);
+}
+
+// Clears the counts and the shadow stack, symbols are kept
+void CallProfile::reset() {
+    nodes.assign(1, Node{ 0, 0, 0, 0, 0 });
+    children.clear();
+    stack.assign(1, Frame{ 0, 0, 0 });
+    cycle_count = 0;
+}
+
+// After a JSR or BRK, PC is the entry point of the new frame
+void CallProfile::enter(const CPU& cpu) {
+    popReleasedFrames(sp_before);
+
+    u32 parent = stack.back().node;
+    u64 key = (u64{parent} << 16) | cpu.PC;
+    auto found = children.find(key);
+    u32 node;
+    if (found != children.end()) {
+        node = found->second;
+    } else {
+        node = static_cast<u32>(nodes.size());
+        nodes.push_back(Node{ cpu.PC, parent, 0, 0, 0 });
+        children.emplace(key, node);
+    }
+
+    nodes[node].calls++;
+    stack.push_back(Frame{ node, sp_before, cycle_count });
+}
+
+// After an RTS or RTI, every frame whose return address has been pulled is closed
+void CallProfile::leave(const CPU& cpu) {
+    popReleasedFrames(cpu.SP);
+}
+
+// Closes frames whose stack space has been given back, the root frame is never closed
+void CallProfile::popReleasedFrames(Byte sp) {
+    while (stack.size() > 1 && stack.back().sp <= sp) {
+        const Frame& frame = stack.back();
+        nodes[frame.node].inclusive_cycles += cycle_count - frame.start_cycle;
+        stack.pop_back();
+    }
+}
+
+// Per subroutine totals, most inclusive cycles first
+std::vector<CallProfile::Entry> CallProfile::entries() const {
+    std::map<Word, Entry> totals;
+    for (u32 index = 1; index < nodes.size(); index++) {
+        const Node& node = nodes[index];
+        Entry& entry = totals.try_emplace(node.address, Entry{ node.address, 0, 0, 0 }).first->second;
+        entry.calls += node.calls;
+        entry.exclusive_cycles += node.exclusive_cycles;
+
+        // A recursive call is already inside an activation of the same address further up
+        bool recursive = false;
+        for (u32 parent = node.parent; parent != 0; parent = nodes[parent].parent) {
+            if (nodes[parent].address == node.address) {
+                recursive = true;
+                break;
+            }
+        }
+        if (!recursive) {
+            entry.inclusive_cycles += node.inclusive_cycles + openCycles(index);
+        }
+    }
+
+    std::vector<Entry> result;
+    result.reserve(totals.size());
+    for (const auto& [address, entry] : totals) {
+        result.push_back(entry);
+    }
+    std::stable_sort(result.begin(), result.end(), [](const Entry& a, const Entry& b) {
+        return a.inclusive_cycles > b.inclusive_cycles;
+    });
+    return result;
+}
+
+// One line per call path with its exclusive cycles
+void CallProfile::writeCollapsed(std::ostream& out) const {
+    for (u32 index = 0; index < nodes.size(); index++) {
+        if (nodes[index].exclusive_cycles > 0) {
+            out << path(index) << ' ' << nodes[index].exclusive_cycles << '\n';
+        }
+    }
+}
+
+void CallProfile::writeCsv(std::ostream& out) const {
+    out << "address,name,calls,inclusive_cycles,exclusive_cycles\n";
+    for (const Entry& entry : entries()) {
+        char address[8];
+        std::snprintf(address, sizeof(address), "0x%04X", entry.address);
+        out << address << ',' << name(entry.address) << ',' << entry.calls << ','
+            << entry.inclusive_cycles << ',' << entry.exclusive_cycles << '\n';
+    }
+}
+
+std::string CallProfile::name(Word address) const {
+    auto found = symbols.find(address);
+    if (found != symbols.end()) {
+        return found->second;
+    }
+
+    char label[8];
+    std::snprintf(label, sizeof(label), "$%04X", address);
+    return label;
+}
+
+// "root;outer;inner" for the node
+std::string CallProfile::path(u32 node) const {
+    std::vector<u32> chain;
+    for (; node != 0; node = nodes[node].parent) {
+        chain.push_back(node);
+    }
+
+    std::string result = "root";
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+        result += ';';
+        result += name(nodes[*it].address);
+    }
+    return result;
+}
+
+// Cycles so far in activations of the node that are still on the stack
+u64 CallProfile::openCycles(u32 node) const {
+    u64 cycles = 0;
+    for (size_t i = 1; i < stack.size(); i++) {
+        if (stack[i].node == node) {
+            cycles += cycle_count - stack[i].start_cycle;
+        }
+    }
+    return cycles;
+}
@@ -0,0 +1,24 @@
+//
+// Base for bus devices that are simulated lazily against the CPU's clock
+//
+
+#include "../include/clocked_device.h"
+
+using namespace emulator_6502;
+
+void ClockedDevice::post(Scheduler::EventId& slot, u64 cycle, std::function<void(u64)> callback) {
+    cancel(slot);
+    slot = scheduler.schedule(cycle, [this, &slot, callback = std::move(callback)](u64 due) {
+        slot = 0;
+        sync(due);
+        callback(due);
+    });
+    cpu.pollSoon();
+}
+
+void ClockedDevice::cancel(Scheduler::EventId& slot) {
+    if (slot) {
+        scheduler.cancel(slot);
+        slot = 0;
+    }
+}
@@ -0,0 +1,107 @@
+//
+// Pre-decoded instructions keyed by PC, used by the decoded core
+//
+
+#include "../include/decoded_cache.h"
+
+using namespace emulator_6502;
+
+namespace {
+
+    struct SuperinstructionPattern {
+        Superinstruction id;
+        Byte opcodes[3];
+        Byte count;
+    };
+
+    // Triples come first so they win over the pair they start with
+    constexpr SuperinstructionPattern superinstruction_patterns[] = {
+        #define EMULATOR_6502_SUPERINSTRUCTION_PAIR(name, first, second) {Superinstruction::name, {first, second, 0}, 2},
+        #define EMULATOR_6502_SUPERINSTRUCTION_TRIPLE(name, first, second, third) {Superinstruction::name, {first, second, third}, 3},
+        EMULATOR_6502_SUPERINSTRUCTIONS(EMULATOR_6502_SUPERINSTRUCTION_PAIR, EMULATOR_6502_SUPERINSTRUCTION_TRIPLE)
+        #undef EMULATOR_6502_SUPERINSTRUCTION_PAIR
+        #undef EMULATOR_6502_SUPERINSTRUCTION_TRIPLE
+    };
+
+}
+
+const DecodedInstruction* DecodedCache::find(Word pc) const {
+    const Table* table = tables[pc >> 8].get();
+    if (table && table->entries[pc & 0xFF].length) {
+        return &table->entries[pc & 0xFF];
+    }
+    return nullptr;
+}
+
+// Decodes the instruction at pc and marks the pages its bytes come from as code
+const DecodedInstruction* DecodedCache::decode(Word pc, Bus& bus) {
+    const OpcodeInfo& info = opcode_table[bus.peek(pc)];
+    if (!info.handler) {
+        return nullptr;
+    }
+
+    // Every byte must come straight from memory, so reading it here has no side effects
+    Byte length = 1 + operandBytes(info.mode);
+    for (Byte offset = 0; offset < length; offset++) {
+        if (!bus.readPage(static_cast<Word>(pc + offset))) {
+            return nullptr;
+        }
+    }
+
+    std::unique_ptr<Table>& table = tables[pc >> 8];
+    if (!table) {
+        table = std::make_unique<Table>();
+    }
+
+    DecodedInstruction& entry = table->entries[pc & 0xFF];
+    entry.opcode = bus.peek(pc);
+    entry.length = length;
+    entry.fused = fuse ? superinstructionAt(pc, bus) : Superinstruction::None;
+    if (entry.fused != Superinstruction::None) {
+        fusion_count++;
+    }
+
+    bus.markCode(pc >> 8);
+    bus.markCode(static_cast<Word>(pc + length - 1) >> 8);
+    decode_count++;
+    return &entry;
+}
+
+// The sequence starting at pc, if every byte of it is on pc's page
+Superinstruction DecodedCache::superinstructionAt(Word pc, Bus& bus) const {
+    for (const SuperinstructionPattern& pattern : superinstruction_patterns) {
+        u32 address = pc;
+        bool matches = true;
+        for (Byte index = 0; index < pattern.count && matches; index++) {
+            const OpcodeInfo& info = opcode_table[pattern.opcodes[index]];
+            u32 end = address + 1 + operandBytes(info.mode);
+            matches = (end - 1) >> 8 == pc >> 8 && bus.peek(static_cast<Word>(address)) == pattern.opcodes[index];
+            address = end;
+        }
+        if (matches) {
+            return pattern.id;
+        }
+    }
+    return Superinstruction::None;
+}
+
+// An instruction near the end of the page before can have its operands on this page, so the last two
+// entries of that page go as well
+void DecodedCache::invalidatePage(u32 index) {
+    if (tables[index]) {
+        tables[index]->entries.fill(DecodedInstruction{});
+    }
+
+    const std::unique_ptr<Table>& previous = tables[(index - 1) & (Bus::PAGE_COUNT - 1)];
+    if (previous) {
+        previous->entries[Bus::PAGE_SIZE - 2] = DecodedInstruction{};
+        previous->entries[Bus::PAGE_SIZE - 1] = DecodedInstruction{};
+    }
+    invalidation_count++;
+}
+
+void DecodedCache::clear() {
+    for (std::unique_ptr<Table>& table : tables) {
+        table.reset();
+    }
+}
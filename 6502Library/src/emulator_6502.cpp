@@ -3,6 +3,12 @@
 //
 
 #include "../include/emulator_6502.h"
+#include "../include/instruction_trace.h"
+#include "../include/opcode_profile.h"
+#include "../include/call_profile.h"
+#include "../include/decoded_cache.h"
+#include "../include/jit.h"
+#include "../include/scheduler.h"
 
 using namespace emulator_6502;
 
@@ -34,244 +40,484 @@ void emulator_6502::outputWord(Word value, const std::string& before_text, bool
               << static_cast<int>(value) << "\n";
 }
 
-// Initialises the dispatch table to handle opcodes
-void emulator_6502::initDispatchTable() {
-    // Load Registers
-    // LDA
-    dispatch_table[0xA9] = handle_LDA_IM;
-    dispatch_table[0xA5] = handle_LDA_ZP;
-    dispatch_table[0xB5] = handle_LDA_ZPX;
-    dispatch_table[0xAD] = handle_LDA_ABS;
-    dispatch_table[0xBD] = handle_LDA_ABSX;
-    dispatch_table[0xB9] = handle_LDA_ABSY;
-    dispatch_table[0xA1] = handle_LDA_INDX;
-    dispatch_table[0xB1] = handle_LDA_INDY;
-
-    // LDX
-    dispatch_table[0xA2] = handle_LDX_IM;
-    dispatch_table[0xA6] = handle_LDX_ZP;
-    dispatch_table[0xB6] = handle_LDX_ZPY;
-    dispatch_table[0xAE] = handle_LDX_ABS;
-    dispatch_table[0xBE] = handle_LDX_ABSY;
-
-    // LDY
-    dispatch_table[0xA0] = handle_LDY_IM;
-    dispatch_table[0xA4] = handle_LDY_ZP;
-    dispatch_table[0xB4] = handle_LDY_ZPX;
-    dispatch_table[0xAC] = handle_LDY_ABS;
-    dispatch_table[0xBC] = handle_LDY_ABSX;
-
-    // STA
-    dispatch_table[0x85] = handle_STA_ZP;
-    dispatch_table[0x95] = handle_STA_ZPX;
-    dispatch_table[0x8D] = handle_STA_ABS;
-    dispatch_table[0x9D] = handle_STA_ABSX;
-    dispatch_table[0x99] = handle_STA_ABSY;
-    dispatch_table[0x81] = handle_STA_INDX;
-    dispatch_table[0x91] = handle_STA_INDY;
-
-    // STX
-    dispatch_table[0x86] = handle_STX_ZP;
-    dispatch_table[0x96] = handle_STX_ZPY;
-    dispatch_table[0x8E] = handle_STX_ABS;
-
-    // STY
-    dispatch_table[0x84] = handle_STY_ZP;
-    dispatch_table[0x94] = handle_STY_ZPX;
-    dispatch_table[0x8C] = handle_STY_ABS;
-
-
-    // Register Transfers
-    dispatch_table[0xAA] = handle_TAX;
-    dispatch_table[0xA8] = handle_TAY;
-    dispatch_table[0x8A] = handle_TXA;
-    dispatch_table[0x98] = handle_TYA;
-
-
-    // Stack Operations
-    dispatch_table[0xBA] = handle_TSX;
-    dispatch_table[0x9A] = handle_TXS;
-    dispatch_table[0x48] = handle_PHA;
-    dispatch_table[0x08] = handle_PHP;
-    dispatch_table[0x68] = handle_PLA;
-    dispatch_table[0x28] = handle_PLP;
-
-
-    // Logical
-    // AND
-    dispatch_table[0x29] = handle_AND_IM;
-    dispatch_table[0x25] = handle_AND_ZP;
-    dispatch_table[0x35] = handle_AND_ZPX;
-    dispatch_table[0x2D] = handle_AND_ABS;
-    dispatch_table[0x3D] = handle_AND_ABSX;
-    dispatch_table[0x39] = handle_AND_ABSY;
-    dispatch_table[0x21] = handle_AND_INDX;
-    dispatch_table[0x31] = handle_AND_INDY;
-
-    // EOR
-    dispatch_table[0x49] = handle_EOR_IM;
-    dispatch_table[0x45] = handle_EOR_ZP;
-    dispatch_table[0x55] = handle_EOR_ZPX;
-    dispatch_table[0x4D] = handle_EOR_ABS;
-    dispatch_table[0x5D] = handle_EOR_ABSX;
-    dispatch_table[0x59] = handle_EOR_ABSY;
-    dispatch_table[0x41] = handle_EOR_INDX;
-    dispatch_table[0x51] = handle_EOR_INDY;
-
-    // IOR
-    dispatch_table[0x09] = handle_IOR_IM;
-    dispatch_table[0x05] = handle_IOR_ZP;
-    dispatch_table[0x15] = handle_IOR_ZPX;
-    dispatch_table[0x0D] = handle_IOR_ABS;
-    dispatch_table[0x1D] = handle_IOR_ABSX;
-    dispatch_table[0x19] = handle_IOR_ABSY;
-    dispatch_table[0x01] = handle_IOR_INDX;
-    dispatch_table[0x11] = handle_IOR_INDY;
-
-    // Bit Test
-    dispatch_table[0x24] = handle_BIT_ZP;
-    dispatch_table[0x2C] = handle_BIT_ABS;
-
-
-    // Arithmetic
-    // Addition
-    dispatch_table[0x69] = handle_ADC_IM;
-    dispatch_table[0x65] = handle_ADC_ZP;
-    dispatch_table[0x75] = handle_ADC_ZPX;
-    dispatch_table[0x6D] = handle_ADC_ABS;
-    dispatch_table[0x7D] = handle_ADC_ABSX;
-    dispatch_table[0x79] = handle_ADC_ABSY;
-    dispatch_table[0x61] = handle_ADC_INDX;
-    dispatch_table[0x71] = handle_ADC_INDY;
-
-    // Subtraction
-    dispatch_table[0xE9] = handle_SBC_IM;
-    dispatch_table[0xE5] = handle_SBC_ZP;
-    dispatch_table[0xF5] = handle_SBC_ZPX;
-    dispatch_table[0xED] = handle_SBC_ABS;
-    dispatch_table[0xFD] = handle_SBC_ABSX;
-    dispatch_table[0xF9] = handle_SBC_ABSY;
-    dispatch_table[0xE1] = handle_SBC_INDX;
-    dispatch_table[0xF1] = handle_SBC_INDY;
-
-    // Comparisons
-    dispatch_table[0xC9] = handle_CMP_IM;
-    dispatch_table[0xC5] = handle_CMP_ZP;
-    dispatch_table[0xD5] = handle_CMP_ZPX;
-    dispatch_table[0xCD] = handle_CMP_ABS;
-    dispatch_table[0xDD] = handle_CMP_ABSX;
-    dispatch_table[0xD9] = handle_CMP_ABSY;
-    dispatch_table[0xC1] = handle_CMP_INDX;
-    dispatch_table[0xD1] = handle_CMP_INDY;
-
-    dispatch_table[0xE0] = handle_CPX_IM;
-    dispatch_table[0xE4] = handle_CPX_ZP;
-    dispatch_table[0xEC] = handle_CPX_ABS;
-
-    dispatch_table[0xC0] = handle_CPY_IM;
-    dispatch_table[0xC4] = handle_CPY_ZP;
-    dispatch_table[0xCC] = handle_CPY_ABS;
-
-
-    // Increments and Decrements
-    dispatch_table[0xE6] = handle_INC_ZP;
-    dispatch_table[0xF6] = handle_INC_ZPX;
-    dispatch_table[0xEE] = handle_INC_ABS;
-    dispatch_table[0xFE] = handle_INC_ABSX;
-    dispatch_table[0xE8] = handle_INX;
-    dispatch_table[0xC8] = handle_INY;
-    dispatch_table[0xC6] = handle_DEC_ZP;
-    dispatch_table[0xD6] = handle_DEC_ZPX;
-    dispatch_table[0xCE] = handle_DEC_ABS;
-    dispatch_table[0xDE] = handle_DEC_ABSX;
-    dispatch_table[0xCA] = handle_DEX;
-    dispatch_table[0x88] = handle_DEY;
-
-
-    // Shifts
-    // Arithmetic Shift Left
-    dispatch_table[0x0A] = handle_ASL;
-    dispatch_table[0x06] = handle_ASL_ZP;
-    dispatch_table[0x16] = handle_ASL_ZPX;
-    dispatch_table[0x0E] = handle_ASL_ABS;
-    dispatch_table[0x1E] = handle_ASL_ABSX;
-
-    // Logical Shift Right
-    dispatch_table[0x4A] = handle_LSR;
-    dispatch_table[0x46] = handle_LSR_ZP;
-    dispatch_table[0x56] = handle_LSR_ZPX;
-    dispatch_table[0x4E] = handle_LSR_ABS;
-    dispatch_table[0x5E] = handle_LSR_ABSX;
-
-    // Rotate Left
-    dispatch_table[0x2A] = handle_ROL;
-    dispatch_table[0x26] = handle_ROL_ZP;
-    dispatch_table[0x36] = handle_ROL_ZPX;
-    dispatch_table[0x2E] = handle_ROL_ABS;
-    dispatch_table[0x3E] = handle_ROL_ABSX;
-
-    // Rotate Right
-    dispatch_table[0x6A] = handle_ROR;
-    dispatch_table[0x66] = handle_ROR_ZP;
-    dispatch_table[0x76] = handle_ROR_ZPX;
-    dispatch_table[0x6E] = handle_ROR_ABS;
-    dispatch_table[0x7E] = handle_ROR_ABSX;
-
-
-    // Jumps and Calls
-    dispatch_table[0x4C] = handle_JMP_ABS;
-    dispatch_table[0x6c] = handle_JMP_IND;
-    dispatch_table[0x20] = handle_JSR;
-    dispatch_table[0x60] = handle_RTS;
-
-
-    // Branches
-    dispatch_table[0x90] = handle_BCC;
-    dispatch_table[0xB0] = handle_BCS;
-    dispatch_table[0xF0] = handle_BEQ;
-    dispatch_table[0x30] = handle_BMI;
-    dispatch_table[0xD0] = handle_BNE;
-    dispatch_table[0x10] = handle_BPL;
-    dispatch_table[0x50] = handle_BVC;
-    dispatch_table[0x70] = handle_BVS;
-
-
-    // Status Flag Changes
-    dispatch_table[0x18] = handle_CLC;
-    dispatch_table[0xD8] = handle_CLD;
-    dispatch_table[0x58] = handle_CLI;
-    dispatch_table[0xB8] = handle_CLV;
-    dispatch_table[0x38] = handle_SEC;
-    dispatch_table[0xF8] = handle_SED;
-    dispatch_table[0x78] = handle_SEI;
-
-
-    // System Functions
-    dispatch_table[0x00] = handle_BRK;
-    dispatch_table[0xEA] = handle_NOP;
-    dispatch_table[0x40] = handle_RTI;
+// Bus
+Bus::Bus() = default;
+Bus::Bus(Bus&& other) noexcept = default;
+Bus& Bus::operator=(Bus&& other) noexcept = default;
+Bus::~Bus() = default;
+
+// Copies the mappings, shared blocks are copied so the two buses do not write into each other
+Bus::Bus(const Bus& other)
+    : read_map(other.read_map), write_map(other.write_map), pages(other.pages),
+      dirty(other.dirty), track_dirty(other.track_dirty), watchpoints(other.watchpoints),
+      watched_read(other.watched_read), watched_write(other.watched_write),
+      watched_execute(other.watched_execute), next_watch_id(other.next_watch_id),
+      watch_stop(other.watch_stop), stop_hit(other.stop_hit) {
+    for (u32 index = 0; index < PAGE_COUNT; index++) {
+        if (pages[index].block) {
+            Page page = pages[index];
+            page.block = std::make_shared<PageBlock>(*page.block);
+            page.backing = page.block->data();
+            setPage(index, page);
+        }
+    }
+}
+
+Bus& Bus::operator=(const Bus& other) {
+    if (this != &other) {
+        *this = Bus(other);
+    }
+    return *this;
+}
+
+// Maps RAM over the given range, reads and writes go straight to 'backing'
+void Bus::mapRAM(u32 start, u32 length, Byte* backing) {
+    checkRange(start, length);
+    for (u32 offset = 0; offset < length; offset += PAGE_SIZE) {
+        setPage((start + offset) / PAGE_SIZE, { backing + offset, nullptr, PageType::RAM });
+    }
+}
+
+// Maps read only memory over the given range, writes are ignored
+void Bus::mapROM(u32 start, u32 length, const Byte* backing, std::shared_ptr<const void> owner) {
+    checkRange(start, length);
+    for (u32 offset = 0; offset < length; offset += PAGE_SIZE) {
+        setPage((start + offset) / PAGE_SIZE, { const_cast<Byte*>(backing + offset), nullptr, PageType::ROM, nullptr, owner });
+    }
+}
+
+// Maps a device over the given range, every access calls into the device
+void Bus::mapDevice(u32 start, u32 length, BusDevice* device) {
+    checkRange(start, length);
+    for (u32 offset = 0; offset < length; offset += PAGE_SIZE) {
+        setPage((start + offset) / PAGE_SIZE, { nullptr, device, PageType::Device });
+    }
+}
+
+// Removes anything mapped over the given range. Reads return 0x00 and writes are ignored
+void Bus::unmap(u32 start, u32 length) {
+    checkRange(start, length);
+    for (u32 offset = 0; offset < length; offset += PAGE_SIZE) {
+        setPage((start + offset) / PAGE_SIZE, {});
+    }
+}
+
+// Repoints pages backed by [old_base, old_base + length) at new_base
+void Bus::rebase(const Byte* old_base, Byte* new_base, u32 length) {
+    for (u32 index = 0; index < PAGE_COUNT; index++) {
+        Page page = pages[index];
+        if (page.backing >= old_base && page.backing < old_base + length) {
+            page.backing = new_base + (page.backing - old_base);
+            setPage(index, page);
+        }
+    }
+}
+
+// Moves RAM pages backed by [base, base + length) into their own shareable blocks
+void Bus::share(const Byte* base, u32 length) {
+    for (u32 index = 0; index < PAGE_COUNT; index++) {
+        Page page = pages[index];
+        if (page.type == PageType::RAM && !page.block && page.backing >= base && page.backing < base + length) {
+            page.block = std::make_shared<PageBlock>();
+            std::copy_n(page.backing, PAGE_SIZE, page.block->data());
+            page.backing = page.block->data();
+            setPage(index, page);
+        }
+    }
+}
+
+// Returns a bus sharing every block with this one. The fork starts without dirty tracking or watchpoints
+Bus Bus::fork() {
+    Bus child;
+    for (u32 index = 0; index < PAGE_COUNT; index++) {
+        child.setPage(index, pages[index]);
+        // Shared blocks go read only on this side too so the first write takes the slow path and copies
+        if (pages[index].block) {
+            write_map[index] = nullptr;
+        }
+    }
+    return child;
+}
+
+// Start of the page's RAM ready to be written
+Byte* Bus::writablePage(u32 index) {
+    Page& page = pages[index];
+    if (page.type != PageType::RAM) {
+        return nullptr;
+    }
+
+    invalidateCode(index);
+    if (page.block && page.block.use_count() > 1) {
+        page.block = std::make_shared<PageBlock>(*page.block);
+        page.backing = page.block->data();
+        read_map[index] = watched_read[index] ? nullptr : page.backing;
+    }
+    if (track_dirty) {
+        dirty.set(index);
+    }
+
+    // Nothing else can see the page now and it is marked, later writes take the fast path unless watched
+    write_map[index] = watched_write[index] ? nullptr : page.backing;
+    return page.backing;
+}
+
+// Turns dirty page tracking on or off, either way the marks are cleared
+void Bus::setDirtyTracking(bool enabled) {
+    track_dirty = enabled;
+    dirty.reset();
+    for (u32 index = 0; index < PAGE_COUNT; index++) {
+        setPage(index, pages[index]);
+    }
+}
+
+// Clears the marks, RAM pages go back to the slow path until they are next written
+void Bus::clearDirty() {
+    dirty.reset();
+    if (track_dirty) {
+        for (u32 index = 0; index < PAGE_COUNT; index++) {
+            if (pages[index].type == PageType::RAM) {
+                write_map[index] = nullptr;
+            }
+        }
+    }
+}
+
+// Adds a watchpoint over [start, start + length) and returns its id
+u32 Bus::addWatchpoint(Word start, u32 length, Byte access, WatchCallback callback) {
+    if (length == 0 || start + length > PAGE_COUNT * PAGE_SIZE) {
+        throw std::invalid_argument("Watchpoints must cover at least one byte within the 64K address space");
+    }
+
+    u32 id = next_watch_id++;
+    watchpoints.push_back(Watchpoint{ id, start, start + length, access, std::move(callback) });
+    updateWatchedPages();
+    return id;
+}
+
+bool Bus::removeWatchpoint(u32 id) {
+    auto found = std::find_if(watchpoints.begin(), watchpoints.end(), [id](const Watchpoint& watch) {
+        return watch.id == id;
+    });
+    if (found == watchpoints.end()) {
+        return false;
+    }
+    watchpoints.erase(found);
+    updateWatchedPages();
+    return true;
+}
+
+void Bus::clearWatchpoints() {
+    watchpoints.clear();
+    watch_stop = false;
+    updateWatchedPages();
+}
+
+// Fires the execute watchpoints covering the instruction at address
+void Bus::checkExecute(Word address) {
+    if (watched_execute[address >> 8]) {
+        hitWatchpoints(address, peek(address), watch_execute);
+    }
+}
+
+bool Bus::takeWatchStop(WatchHit& hit) {
+    if (!watch_stop) {
+        return false;
+    }
+    hit = stop_hit;
+    watch_stop = false;
+    return true;
+}
+
+// Recomputes which pages have watchpoints and takes those off the fast path
+void Bus::updateWatchedPages() {
+    watched_read.reset();
+    watched_write.reset();
+    watched_execute.reset();
+    for (const Watchpoint& watch : watchpoints) {
+        for (u32 index = watch.start >> 8; index <= (watch.end - 1) >> 8; index++) {
+            watched_read[index] = watched_read[index] || (watch.access & watch_read);
+            watched_write[index] = watched_write[index] || (watch.access & watch_write);
+            watched_execute[index] = watched_execute[index] || (watch.access & watch_execute);
+        }
+    }
+    for (u32 index = 0; index < PAGE_COUNT; index++) {
+        setPage(index, pages[index]);
+    }
+}
+
+// Calls the watchpoints that cover the access, the first one that asks to stop is kept for run()
+void Bus::hitWatchpoints(Word address, Byte value, Byte access) {
+    for (const Watchpoint& watch : watchpoints) {
+        if ((watch.access & access) && address >= watch.start && address < watch.end) {
+            WatchHit hit{ watch.id, address, value, access };
+            if ((!watch.callback || watch.callback(hit)) && !watch_stop) {
+                watch_stop = true;
+                stop_hit = hit;
+            }
+        }
+    }
+}
+
+DecodedCache& Bus::decodedCache() {
+    if (!decoded) {
+        decoded = std::make_unique<DecodedCache>();
+    }
+    return *decoded;
+}
+
+JitCache& Bus::jitCache() {
+    if (!jit) {
+        jit = std::make_unique<JitCache>();
+    }
+    return *jit;
+}
+
+void Bus::markCode(u32 index) {
+    code_pages.set(index);
+    write_map[index] = nullptr;
+}
+
+void Bus::clearDecodedCache() {
+    if (decoded) {
+        decoded->clear();
+    }
+    if (jit) {
+        jit->clear();
+    }
+    code_pages.reset();
+    code_generation++;
+    for (u32 index = 0; index < PAGE_COUNT; index++) {
+        setPage(index, pages[index]);
+    }
+}
+
+// Drops the page's decoded instructions and blocks if it has any, it stops being a code page
+void Bus::invalidateCode(u32 index) {
+    if (code_pages[index]) {
+        code_pages.reset(index);
+        code_generation++;
+        if (decoded) {
+            decoded->invalidatePage(index);
+        }
+        if (jit) {
+            jit->invalidatePage(index);
+        }
+    }
+}
+
+// Stores the page and updates the fast lookups
+// Block pages, tracked pages and code pages start with no write pointer, the first write goes through
+// writablePage. Watched pages have no pointers at all so every access reaches the slow path
+void Bus::setPage(u32 index, const Page& page) {
+    const Page& old = pages[index];
+    if (old.backing != page.backing || old.device != page.device || old.type != page.type) {
+        invalidateCode(index);
+    }
+    // Translated blocks read and write memory directly, they are built knowing no device was there
+    if (page.device && old.device != page.device && jit) {
+        jit->clear();
+    }
+
+    pages[index] = page;
+    bool direct_read = (page.type == PageType::RAM || page.type == PageType::ROM) && !watched_read[index];
+    bool direct_write = page.type == PageType::RAM && !page.block && !track_dirty && !watched_write[index] &&
+                        !code_pages[index];
+    read_map[index] = direct_read ? page.backing : nullptr;
+    write_map[index] = direct_write ? page.backing : nullptr;
+}
+
+// Reads from a device, unmapped or watched page
+Byte Bus::readSlow(Word address) {
+    const Page& page = pages[address >> 8];
+    Byte value = 0x00;
+    if (page.device) {
+        value = page.device->read(address);
+    } else if (page.type == PageType::RAM || page.type == PageType::ROM) {
+        value = page.backing[address & 0xFF];
+    }
+
+    if (watched_read[address >> 8]) {
+        hitWatchpoints(address, value, watch_read);
+    }
+    return value;
+}
+
+// Writes to a device, ROM, unmapped or watched page, or the first write to a shared block or clean
+// tracked page
+void Bus::writeSlow(Word address, Byte value) {
+    if (watched_write[address >> 8]) {
+        hitWatchpoints(address, value, watch_write);
+    }
+
+    const Page& page = pages[address >> 8];
+    if (page.device) {
+        page.device->write(address, value);
+    } else if (page.type == PageType::RAM) {
+        writablePage(address >> 8)[address & 0xFF] = value;
+    }
+}
+
+// Throws if the range is not page aligned or runs past the end of the address space
+void Bus::checkRange(u32 start, u32 length) {
+    if (start % PAGE_SIZE != 0 || length % PAGE_SIZE != 0 || start + length > PAGE_COUNT * PAGE_SIZE) {
+        throw std::invalid_argument("Bus mappings must be page aligned and within the 64K address space");
+    }
 }
 
 
 // Memory
+// Maps the whole address space as RAM backed by 'data'. The contents are left uninitialised
+Memory::Memory() {
+    bus.mapRAM(0, MAX_MEMORY, data);
+}
+
+// Copies the contents and the mappings, pages backed by the other memory's data now use this one's
+Memory::Memory(const Memory& other) : bus(other.bus) {
+    std::copy(std::begin(other.data), std::end(other.data), data);
+    bus.rebase(other.data, data, MAX_MEMORY);
+    if (other.baseline) {
+        baseline = std::make_unique<Byte[]>(MAX_MEMORY);
+        std::copy_n(other.baseline.get(), MAX_MEMORY, baseline.get());
+    }
+}
+
+Memory& Memory::operator=(const Memory& other) {
+    if (this != &other) {
+        std::copy(std::begin(other.data), std::end(other.data), data);
+        bus = other.bus;
+        bus.rebase(other.data, data, MAX_MEMORY);
+        baseline.reset();
+        if (other.baseline) {
+            baseline = std::make_unique<Byte[]>(MAX_MEMORY);
+            std::copy_n(other.baseline.get(), MAX_MEMORY, baseline.get());
+        }
+    }
+    return *this;
+}
+
+// Copy on write clone, only the page tables are copied
+std::unique_ptr<Memory> Memory::fork() {
+    bus.share(data, MAX_MEMORY);
+
+    auto child = std::make_unique<Memory>();
+    child->bus = bus.fork();
+    return child;
+}
+
+// Copies the address space out as the CPU would read it, without touching devices
+void Memory::copyOut(Byte* out) const {
+    for (u32 index = 0; index < Bus::PAGE_COUNT; index++) {
+        std::copy_n(pageContents(index), Bus::PAGE_SIZE, out + index * Bus::PAGE_SIZE);
+    }
+}
+
+// Copies a whole address space in. RAM pages go through the bus, ROM, device and unmapped pages into 'data'
+void Memory::copyIn(const Byte* in) {
+    copyIn(0, in, MAX_MEMORY);
+}
+
+// Copies a range in, page by page, the same way as the whole address space
+void Memory::copyIn(Word address, const Byte* in, size_t length) {
+    size_t end = std::min<size_t>(address + length, MAX_MEMORY);
+    for (size_t current = address; current < end;) {
+        u32 index = static_cast<u32>(current / Bus::PAGE_SIZE);
+        size_t offset = current % Bus::PAGE_SIZE;
+        size_t count = std::min<size_t>(Bus::PAGE_SIZE - offset, end - current);
+
+        Byte* target = bus.writablePage(index);
+        if (!target) {
+            target = data + index * Bus::PAGE_SIZE;
+        }
+        std::copy_n(in + (current - address), count, target + offset);
+        current += count;
+    }
+}
+
+// Turns dirty tracking on, taking a checkpoint, or off, dropping the checkpoint
+void Memory::setDirtyTracking(bool enabled) {
+    if (enabled) {
+        baseline = std::make_unique<Byte[]>(MAX_MEMORY);
+        copyOut(baseline.get());
+    } else {
+        baseline.reset();
+    }
+    bus.setDirtyTracking(enabled);
+}
+
+// Records the dirty pages into the baseline and clears the marks. Costs O(dirty pages)
+void Memory::checkpoint() {
+    if (!baseline) {
+        return;
+    }
+
+    const auto& dirty = bus.dirtyPages();
+    for (u32 index = 0; index < Bus::PAGE_COUNT; index++) {
+        if (dirty[index]) {
+            std::copy_n(pageContents(index), Bus::PAGE_SIZE, baseline.get() + index * Bus::PAGE_SIZE);
+        }
+    }
+    bus.clearDirty();
+}
+
+// Byte ranges that differ from the last checkpoint, runs touching across a page boundary are merged
+std::vector<Memory::Range> Memory::changedRanges() const {
+    std::vector<Range> ranges;
+    if (!baseline) {
+        return ranges;
+    }
+
+    const auto& dirty = bus.dirtyPages();
+    for (u32 index = 0; index < Bus::PAGE_COUNT; index++) {
+        if (!dirty[index]) {
+            continue;
+        }
+
+        const Byte* current = pageContents(index);
+        const Byte* previous = baseline.get() + index * Bus::PAGE_SIZE;
+        for (u32 offset = 0; offset < Bus::PAGE_SIZE; offset++) {
+            if (current[offset] == previous[offset]) {
+                continue;
+            }
+
+            u32 address = index * Bus::PAGE_SIZE + offset;
+            if (!ranges.empty() && ranges.back().start + ranges.back().length == address) {
+                ranges.back().length++;
+            } else {
+                ranges.push_back({ static_cast<Word>(address), 1 });
+            }
+        }
+    }
+    return ranges;
+}
+
+// Where a page's contents live, its bus backing for RAM / ROM and 'data' otherwise
+const Byte* Memory::pageContents(u32 index) const {
+    const Bus::Page& page = bus.page(index * Bus::PAGE_SIZE);
+    return page.backing ? page.backing : data + index * Bus::PAGE_SIZE;
+}
+
 // Initializes memory to 0x0000
 void Memory::initMemory() {
-    for (unsigned char & i : data) {
-        i = 0;
-    }
+    fill(0x00);
 
     std::cout << "Memory initialized" << std::endl;
 }
 
 // Sets the whole memory to the value passed in
 void Memory::setMemory(Byte to_set) {
-    for (unsigned char & i : data) {
-        i = to_set;
-    }
+    fill(to_set);
 
     outputByte(to_set, "Memory Set to: ");
 }
 
+// Fills every page the way copyIn writes them
+void Memory::fill(Byte value) {
+    for (u32 index = 0; index < Bus::PAGE_COUNT; index++) {
+        Byte* target = bus.writablePage(index);
+        std::fill_n(target ? target : data + index * Bus::PAGE_SIZE, Bus::PAGE_SIZE, value);
+    }
+}
+
 // Loads a .bin file into the memory
 bool Memory::loadMemory(std::string &loc) {
     std::ifstream file(loc, std::ios::binary);
@@ -290,13 +536,15 @@ bool Memory::loadMemory(std::string &loc) {
         return false;
     }
 
-    file.read(reinterpret_cast<char*>(data), MAX_MEMORY);
+    std::vector<Byte> contents(MAX_MEMORY);
+    file.read(reinterpret_cast<char*>(contents.data()), MAX_MEMORY);
     std::streamsize bytes_read = file.gcount();
 
     if (bytes_read == 0) {
         std::cerr << "Warning: File is empty or could not be read " << loc << std::endl;
         return false;
     }
+    copyIn(0, contents.data(), static_cast<size_t>(bytes_read));
 
     std::cout << "Loaded " << bytes_read << " bytes into memory" << std::endl;
     return true;
@@ -342,42 +590,16 @@ void Memory::promptMemoryLoad() {
 // Dumps the given memory section to the console
 void Memory::dumpMemory(size_t start, size_t length) {
     std::cout << "Memory Dump ###" << std::endl;
-    const size_t bytes_per_row = 32;
-
-    for (size_t addr = start; addr < start + length; addr += bytes_per_row) {
-        // Print address
-        std::cout << std::hex << std::setw(4) << std::setfill('0') << addr << "  ";
-
-        // Print hex bytes
-        for (size_t i = 0; i < bytes_per_row; ++i) {
-            if (addr + i < MAX_MEMORY)
-                std::cout << std::setw(2) << std::setfill('0') << static_cast<int>(data[addr + i]) << " ";
-            else
-                std::cout << "   ";
-        }
-
-        std::cout << " ";
-
-        // Print ASCII representation
-        for (size_t i = 0; i < bytes_per_row; ++i) {
-            if (addr + i < MAX_MEMORY) {
-                char c = static_cast<char>(data[addr + i]);
-                std::cout << (std::isprint(c) ? c : '.');
-            }
-        }
-
-        std::cout << '\n';
-    }
-
-    // Reset formatting
-    std::cout << std::dec << std::setfill(' ');
 
+    std::vector<char>& buffer = dumpBuffer();
+    size_t size = formatDump(buffer, start, length, 32);
+    std::cout.write(buffer.data(), static_cast<std::streamsize>(size));
 
     std::cout << "Memory Dump End ###" << std::endl;
 }
 
 // Dumps the given memory section to the file
-void Memory::dumpMemoryToFile(size_t start, size_t length) {
+void Memory::dumpMemoryToFile(size_t start, size_t length, DumpFormat format) {
     namespace fs = std::filesystem;
 
     // Ensure /dumps/ directory exists
@@ -399,48 +621,89 @@ void Memory::dumpMemoryToFile(size_t start, size_t length) {
                    << std::setw(2) << std::setfill('0') << tm.tm_hour
                    << std::setw(2) << std::setfill('0') << tm.tm_min
                    << std::setw(2) << std::setfill('0') << tm.tm_sec
-                   << ".txt";
+                   << (format == DumpFormat::Binary ? ".bin" : ".txt");
 
     fs::path filePath = dump_dir / file_stream.str();
 
-    std::ofstream file(filePath);
+    // Render everything first so the file gets a single write
+    std::vector<char>& buffer = dumpBuffer();
+    size_t size = 0;
+    if (format == DumpFormat::Binary) {
+        start = std::min<size_t>(start, MAX_MEMORY);
+        size = std::min(length, MAX_MEMORY - start);
+        buffer.resize(std::max(buffer.size(), size));
+        for (size_t i = 0; i < size; i++) {
+            buffer[i] = static_cast<char>(byteAt(start + i));
+        }
+    } else {
+        size = formatDump(buffer, start, length, 16);
+    }
+
+    std::FILE* file = std::fopen(filePath.string().c_str(), "wb");
     if (!file) {
         std::cerr << "Failed to open file: " << filePath << "\n";
         return;
     }
+    std::setvbuf(file, nullptr, _IONBF, 0);
+    std::fwrite(buffer.data(), 1, size, file);
+    std::fclose(file);
 
-    constexpr size_t bytes_per_row = 16;
+    std::cout << "Memory dump saved to: " << filePath << '\n';
+}
 
-    for (size_t addr = start; addr < start + length; addr += bytes_per_row) {
-        file << std::hex << std::setw(4) << std::setfill('0') << addr << "  ";
+// Renders rows of "aaaa  xx xx ..  ascii" into the buffer, growing it if needed. Returns the length
+size_t Memory::formatDump(std::vector<char>& buffer, size_t start, size_t length, size_t bytes_per_row) const {
+    static constexpr char hex_digits[] = "0123456789abcdef";
 
-        for (size_t i = 0; i < bytes_per_row; ++i) {
-            if (addr + i < MAX_MEMORY)
-                file << std::setw(2) << std::setfill('0') << static_cast<int>(data[addr + i]) << " ";
-            else
-                file << "   ";
-        }
+    start = std::min<size_t>(start, MAX_MEMORY);
+    length = std::min(length, MAX_MEMORY - start);
+    const size_t rows = (length + bytes_per_row - 1) / bytes_per_row;
+    const size_t row_size = 4 + 2 + bytes_per_row * 3 + 1 + bytes_per_row + 1;
+    buffer.resize(std::max(buffer.size(), rows * row_size));
 
-        file << " ";
+    char* out = buffer.data();
+    for (size_t addr = start; addr < start + length; addr += bytes_per_row) {
+        // Address
+        for (int shift = 12; shift >= 0; shift -= 4) {
+            *out++ = hex_digits[(addr >> shift) & 0xF];
+        }
+        *out++ = ' ';
+        *out++ = ' ';
 
+        // Hex bytes
         for (size_t i = 0; i < bytes_per_row; ++i) {
             if (addr + i < MAX_MEMORY) {
-                char c = static_cast<char>(data[addr + i]);
-                file << (std::isprint(c) ? c : '.');
+                Byte value = byteAt(addr + i);
+                *out++ = hex_digits[value >> 4];
+                *out++ = hex_digits[value & 0xF];
+            } else {
+                *out++ = ' ';
+                *out++ = ' ';
             }
+            *out++ = ' ';
         }
+        *out++ = ' ';
 
-        file << '\n';
+        // ASCII representation
+        for (size_t i = 0; i < bytes_per_row && addr + i < MAX_MEMORY; ++i) {
+            Byte value = byteAt(addr + i);
+            *out++ = (value >= 0x20 && value < 0x7F) ? static_cast<char>(value) : '.';
+        }
+        *out++ = '\n';
     }
+    return out - buffer.data();
+}
 
-    file.close();
-    std::cout << "Memory dump saved to: " << filePath << '\n';
+// Scratch space for dumps, kept between calls so repeated dumps do not allocate
+std::vector<char>& Memory::dumpBuffer() {
+    thread_local std::vector<char> buffer;
+    return buffer;
 }
 
 // Write a word to the specified memory address
 void Memory::writeWord(s32 &clock_cycles, u32 address, Word value) {
-    data[address] = value & 0xFF;
-    data[address + 1] = (value >> 8);
+    bus.write(address, value & 0xFF);
+    bus.write(address + 1, value >> 8);
     clock_cycles -= 2;
 }
 
@@ -478,14 +741,12 @@ CPU::StatusFlags CPU::unpackStatusFlags(Byte value) {
 
 // Sets the 6502 into a reset state
 void CPU::reset(Memory& memory) {
-    initDispatchTable();
-
     PC = 0xFFFC; // Reset Vector 0xFFFC 0xFFFD
     SP = 0xFF;
 
     // Gets the address from the reset vector
-    Byte start_low = memory[PC];
-    Byte start_high = memory[PC+1];
+    Byte start_low = memory.bus.read(PC);
+    Byte start_high = memory.bus.read(PC+1);
     Word start_addr = start_low | (start_high << 8);
 
     PC = start_addr; // <- Where to start program from
@@ -499,7 +760,7 @@ void CPU::reset(Memory& memory) {
 // *** Reading from memory ***
 // Gets and returns the Byte value at PC, increments PC
 Byte CPU::fetchByte(s32& clock_cycles, Memory& memory) {
-    Byte data = memory[PC];
+    Byte data = memory.bus.read(PC);
     PC++;
 
     clock_cycles--;
@@ -514,7 +775,7 @@ SByte CPU::fetchSByte(s32 &clock_cycles, Memory &memory) {
 // Gets and returns the Byte value at the address, DOES NOT increment PC (Takes byte as address)
 /*
  Byte CPU::readByte(s32 &clock_cycles, Memory &memory, Byte address) {
-    Byte data = memory[address];
+    Byte data = memory.bus.read(address);
     clock_cycles--;
     return data;
 }
@@ -522,7 +783,7 @@ SByte CPU::fetchSByte(s32 &clock_cycles, Memory &memory) {
 
 // Gets and returns the Byte value at the address, DOES NOT increment PC (Takes word as address)
 Byte CPU::readByte(s32 &clock_cycles, Memory &memory, Word address) {
-    Byte data = memory[address];
+    Byte data = memory.bus.read(address);
     clock_cycles--;
     return data;
 }
@@ -531,10 +792,10 @@ Byte CPU::readByte(s32 &clock_cycles, Memory &memory, Word address) {
 Word CPU::fetchWord(s32& clock_cycles, Memory& memory) {
     // Note: Little Endian
 
-    Word data = memory[PC];
+    Word data = memory.bus.read(PC);
     PC++;
 
-    data |= (memory[PC] << 8);
+    data |= (memory.bus.read(PC) << 8);
     PC++;
 
     clock_cycles-=2;
@@ -552,15 +813,457 @@ Word CPU::readWord(s32& clock_cycles, Memory& memory, Word address) {
 // *** Writing to memory ***
 // Writes the byte 'value' to the memory address specified
 void CPU::writeByte(s32 &clock_cycles, Memory &memory, Word address, Byte value) {
-    memory[address] = value;
+    memory.bus.write(address, value);
     clock_cycles--;
 }
 
-// Executes the specified cycle amount of cycles on the 6502
+// Executes the specified cycle amount of cycles on the 6502 using the selected core
 void CPU::execute(s32 cycles, Memory& memory) {
+    execute<Timing::Exact>(cycles, memory);
+}
+
+// Executes the budget, counted the way the timing policy says, on the selected core
+template <CPU::Timing timing>
+void CPU::execute(s32 budget, Memory& memory) {
+    if (core == Core::Switch) {
+        executeSwitch<timing>(budget, memory);
+    } else if (core == Core::Decoded) {
+        executeDecoded<timing>(budget, memory);
+    } else if (core == Core::Jit) {
+        executeJit<timing>(budget, memory);
+    } else {
+        executeDispatchTable<timing>(budget, memory);
+    }
+}
+
+u64 CPU::executeCycles(u64 cycles, Memory& memory) {
+    return executeCycles<Timing::Exact>(cycles, memory);
+}
+
+// The carried cycles have already run, so they come off this call's budget first
+template <CPU::Timing timing>
+u64 CPU::executeCycles(u64 cycles, Memory& memory) {
+    if (cycles <= carried_cycles) {
+        carried_cycles -= cycles;
+        return 0;
+    }
+
+    const u64 start = cycle();
+    const u64 target = start + (cycles - carried_cycles);
+    while (cycle() < target) {
+        execute<timing>(static_cast<s32>(std::min<u64>(target - cycle(), std::numeric_limits<s32>::max())), memory);
+    }
+    carried_cycles = cycle() - target;
+    return cycle() - start;
+}
+
+namespace {
+
+    // Hooks run around each instruction by the instrumented loops
+    inline void beforeInstruction(CPU& cpu, Memory& memory, u64 trace_cycle) {
+        if (cpu.trace) {
+            cpu.trace->record(cpu, memory, trace_cycle);
+        }
+        if (cpu.profile) {
+            cpu.profile->begin(cpu);
+        }
+        if (cpu.call_profile) {
+            cpu.call_profile->begin(cpu);
+        }
+    }
+
+    inline void afterInstruction(CPU& cpu, Byte opcode, s32 cycles_used) {
+        if (cpu.profile) {
+            cpu.profile->end(cpu, opcode, cycles_used);
+        }
+        if (cpu.call_profile) {
+            cpu.call_profile->end(cpu, opcode, cycles_used);
+        }
+    }
+
+
+    // Exact timing lets the handlers charge the budget as they go. The other policies give them a
+    // counter that is never read, so once the handlers are inlined the compiler drops their charges
+    template <CPU::Timing timing>
+    inline s32& handlerCycles(s32& budget, s32& discarded) {
+        if constexpr (timing == CPU::Timing::Exact) {
+            return budget;
+        } else {
+            return discarded;
+        }
+    }
+
+    // Charges a finished instruction for the policies that count per instruction
+    template <CPU::Timing timing>
+    inline void chargeInstruction(s32& budget, Byte opcode) {
+        if constexpr (timing == CPU::Timing::Fast) {
+            budget -= opcode_table[opcode].cycles;
+        } else if constexpr (timing == CPU::Timing::Instructions) {
+            budget--;
+        }
+    }
+
+    // One instruction of a superinstruction, opcode fetch included. The opcode is a constant, so only
+    // its own handler is left once this is inlined
+    template <CPU::Timing timing, Byte opcode>
+    inline void runFusedInstruction(CPU& cpu, s32& budget, Memory& memory) {
+        cpu.clock_budget = budget;
+        s32 discarded = 0;
+        s32& cycles = handlerCycles<timing>(budget, discarded);
+        cpu.PC++;
+        cycles--;
+        switch (opcode) {
+            #define EMULATOR_6502_SWITCH_CASE(opcode, handler, ...) case opcode: handler(cpu, cycles, memory); break;
+            EMULATOR_6502_OPCODES(EMULATOR_6502_SWITCH_CASE)
+            #undef EMULATOR_6502_SWITCH_CASE
+
+            default:
+                break;
+        }
+        chargeInstruction<timing>(budget, opcode);
+    }
+
+    // Runs the instructions of a superinstruction one after another, stopping between them when the
+    // budget runs out or a poll is due just as the loop would
+    template <CPU::Timing timing>
+    inline void runSuperinstruction(CPU& cpu, Superinstruction fused, s32& budget, Memory& memory) {
+        switch (fused) {
+            #define EMULATOR_6502_FUSED_PAIR(name, first, second)                 \
+            case Superinstruction::name:                                           \
+                runFusedInstruction<timing, first>(cpu, budget, memory);           \
+                if (budget > 0 && budget > cpu.poll_budget) {                      \
+                    runFusedInstruction<timing, second>(cpu, budget, memory);      \
+                }                                                                  \
+                break;
+            #define EMULATOR_6502_FUSED_TRIPLE(name, first, second, third)        \
+            case Superinstruction::name:                                           \
+                runFusedInstruction<timing, first>(cpu, budget, memory);           \
+                if (budget > 0 && budget > cpu.poll_budget) {                      \
+                    runFusedInstruction<timing, second>(cpu, budget, memory);      \
+                    if (budget > 0 && budget > cpu.poll_budget) {                  \
+                        runFusedInstruction<timing, third>(cpu, budget, memory);   \
+                    }                                                              \
+                }                                                                  \
+                break;
+            EMULATOR_6502_SUPERINSTRUCTIONS(EMULATOR_6502_FUSED_PAIR, EMULATOR_6502_FUSED_TRIPLE)
+            #undef EMULATOR_6502_FUSED_PAIR
+            #undef EMULATOR_6502_FUSED_TRIPLE
+
+            case Superinstruction::None:
+                break;
+        }
+    }
+
+    // Backward jumps shorter than this are looked at as possible idle loops
+    constexpr Word IDLE_LOOP_BYTES = 16;
+    // Stands in for the jumping opcode where a superinstruction or translated block ended with a branch
+    constexpr Byte BRANCH_OPCODE = 0xD0;
+
+    // Loops execute() has found not to be idle, so the check stays cheap while they run
+    struct IdleLoop {
+        u32 rejected = 0x10000;     // Out of Word range until a loop is rejected
+        u32 unsettled = 0x10000;    // Loop whose state changed on its last probe, rejected if it does again
+    };
+
+    // The number of instructions in the loop from 'target' back to 'target', closed by a branch or JMP
+    // at or after 'from', if its other instructions are all idle loop instructions reading RAM or ROM.
+    // 0 for any other code
+    u32 idleLoopLength(Word target, Word from, Bus& bus) {
+        bool passed_from = false;
+        u32 instructions = 1;
+        u32 address = target;
+        while (address < static_cast<u32>(target) + 2 * IDLE_LOOP_BYTES) {
+            Word pc = static_cast<Word>(address);
+            passed_from |= pc == from;
+            Byte opcode = bus.peek(pc);
+            const OpcodeInfo& info = opcode_table[opcode];
+            Byte length = 1 + operandBytes(info.mode);
+            for (Byte offset = 0; offset < length; offset++) {
+                if (!bus.readPage(static_cast<Word>(pc + offset))) {
+                    return 0;
+                }
+            }
+            Word operand = bus.peek(static_cast<Word>(pc + 1)) | bus.peek(static_cast<Word>(pc + 2)) << 8;
+
+            if (info.mode == AddressingMode::Relative) {
+                auto offset = static_cast<SByte>(operand & 0xFF);
+                return passed_from && static_cast<Word>(pc + 2 + offset) == target ? instructions : 0;
+            }
+            if (info.handler == handle_JMP_ABS) {
+                return passed_from && operand == target ? instructions : 0;
+            }
+            if (!idle_loop_table[opcode]) {
+                return 0;
+            }
+
+            // Anything the operand can read must be plain memory. Page zero is always checked as some
+            // absolute handlers read through a zero page address
+            if (info.mode != AddressingMode::Implied && info.mode != AddressingMode::Immediate) {
+                bool indexed = info.mode == AddressingMode::AbsoluteX || info.mode == AddressingMode::AbsoluteY;
+                if (!bus.readPage(0)
+                    || (length == 3 && !bus.readPage(operand))
+                    || (indexed && !bus.readPage(static_cast<Word>(operand + 0xFF)))) {
+                    return 0;
+                }
+            }
+            address += length;
+            instructions++;
+        }
+        return 0;
+    }
+
+    // Called when the instruction at 'from' has just jumped back a short way. A copy of the CPU runs
+    // one pass of the loop, which only reads plain memory so has no side effects, and stops after its
+    // closing branch. If it arrives back with the same registers and flags the loop can never leave,
+    // so every whole pass before the budget runs out or the next poll is due is charged at once and
+    // the rest runs as normal, stopping exactly where it would have
+    template <CPU::Timing timing>
+    EMULATOR_6502_NOINLINE void skipIdleLoop(CPU& cpu, Word from, s32& budget, Memory& memory, IdleLoop& loop) {
+        u32 instructions = idleLoopLength(cpu.PC, from, memory.bus);
+        if (instructions == 0) {
+            loop.rejected = cpu.PC;
+            return;
+        }
+
+        CPU probe = cpu;
+        probe.trace = nullptr;
+        probe.profile = nullptr;
+        probe.call_profile = nullptr;
+        s32 pass = 0;
+        for (u32 count = 0; count < instructions; count++) {
+            Byte opcode = memory.bus.peek(probe.PC);
+            s32 cycles = probe.runInstruction(memory);
+            if constexpr (timing == CPU::Timing::Exact) {
+                pass += cycles;
+            } else if constexpr (timing == CPU::Timing::Fast) {
+                pass += opcode_table[opcode].cycles;
+            } else {
+                pass++;
+            }
+        }
+
+        if (probe.PC != cpu.PC || probe.Accumulator != cpu.Accumulator || probe.X_reg != cpu.X_reg
+            || probe.Y_reg != cpu.Y_reg || probe.SP != cpu.SP
+            || CPU::packStatusFlags(probe.flags) != CPU::packStatusFlags(cpu.flags)) {
+            if (loop.unsettled == cpu.PC) {
+                loop.rejected = cpu.PC;
+            }
+            loop.unsettled = cpu.PC;
+            return;
+        }
+
+        // Only as far as the next scheduled event or interrupt
+        s32 floor = std::max(cpu.poll_budget, 0);
+        s32 passes = budget > floor ? (budget - floor - 1) / pass : 0;
+        budget -= passes * pass;
+        cpu.page_crossings += passes * (probe.page_crossings - cpu.page_crossings);
+        cpu.branches_taken += passes * (probe.branches_taken - cpu.branches_taken);
+        cpu.idle_iterations_skipped += passes;
+    }
+
+    // Only branches and JMP close an idle loop. RTS also lands a little way back, right after the JSR
+    inline bool closesLoop(Byte opcode) {
+        return opcode_table[opcode].mode == AddressingMode::Relative || opcode_table[opcode].handler == handle_JMP_ABS;
+    }
+
+    // The cheap part of the idle loop check, run after every instruction. 'opcode' is the one that
+    // jumped, or a branch when only that is known
+    template <CPU::Timing timing, bool Instrumented>
+    inline void checkIdleLoop(CPU& cpu, Word from, Byte opcode, s32& budget, Memory& memory, IdleLoop& loop) {
+        if constexpr (!Instrumented) {
+            if (static_cast<Word>(from - cpu.PC) < IDLE_LOOP_BYTES && closesLoop(opcode) && cpu.PC != loop.rejected
+                && cpu.skip_idle_loops && budget > 0) {
+                skipIdleLoop<timing>(cpu, from, budget, memory, loop);
+            }
+        }
+    }
+
+}
+
+// Executes the budget by calling through the dispatch table
+template <CPU::Timing timing>
+void CPU::executeDispatchTable(s32 budget, Memory& memory) {
+    if (trace || profile || call_profile) {
+        runDispatchTable<timing, true>(budget, memory);
+    } else {
+        runDispatchTable<timing, false>(budget, memory);
+    }
+}
+
+// Executes the budget with a single switch
+template <CPU::Timing timing>
+void CPU::executeSwitch(s32 budget, Memory& memory) {
+    if (trace || profile || call_profile) {
+        runSwitch<timing, true>(budget, memory);
+    } else {
+        runSwitch<timing, false>(budget, memory);
+    }
+}
+
+// Executes the budget from the decoded instruction cache
+template <CPU::Timing timing>
+void CPU::executeDecoded(s32 budget, Memory& memory) {
+    if (trace || profile || call_profile) {
+        runDecoded<timing, true>(budget, memory);
+    } else {
+        runDecoded<timing, false>(budget, memory);
+    }
+}
+
+// Executes the budget from translated blocks where it can
+template <CPU::Timing timing>
+void CPU::executeJit(s32 budget, Memory& memory) {
+    if (timing != Timing::Exact || !JitCache::supported() || trace || profile || call_profile) {
+        executeSwitch<timing>(budget, memory);
+    } else {
+        runJit(budget, memory);
+    }
+}
+
+// Runs one instruction through the dispatch table and returns the cycles it took
+s32 CPU::step(Memory& memory) {
+    s32 cycles = runInstruction(memory);
+    slice_start += static_cast<u64>(cycles);
+    return cycles;
+}
+
+s32 CPU::runInstruction(Memory& memory) {
+    s32 cycles = 0;
+    Byte instruction = fetchByte(cycles, memory);
+    InstructionHandler handler = dispatch_table[instruction];
+    if (!handler) {
+        invalidInstruction(memory);
+    }
+    handler(*this, cycles, memory);
+    return -cycles;
+}
+
+// *** Interrupts ***
+void CPU::setIRQ(u32 source, bool asserted) {
+    if (asserted) {
+        irq_sources |= source;
+        poll_budget = std::numeric_limits<s32>::max();      // Looked at before the next instruction
+    } else {
+        irq_sources &= ~source;
+    }
+}
+
+void CPU::triggerNMI() {
+    nmi_pending = true;
+    poll_budget = std::numeric_limits<s32>::max();
+}
+
+void CPU::beginSlice(s32 budget) {
+    slice_start = cycle();
+    slice_budget = budget;
+    clock_budget = budget;
+    if (scheduler) {
+        scheduler->advanceTo(slice_start);
+    }
+    updatePollBudget(budget);
+}
+
+// The clock keeps any overshoot of the last instruction
+void CPU::endSlice(s32 budget) {
+    clock_budget = budget;
+    if (scheduler) {
+        scheduler->advanceTo(cycle());
+    }
+}
+
+// Works out the budget at which the loops next need to look. An IRQ held while flags.I is set is looked
+// at before every instruction, as any of them might clear I
+void CPU::updatePollBudget(s32 budget) {
+    if (nmi_pending || irq_sources) {
+        poll_budget = std::numeric_limits<s32>::max();
+        return;
+    }
+
+    u64 deadline = scheduler ? scheduler->nextDeadline() : Scheduler::NO_EVENT;
+    if (deadline == Scheduler::NO_EVENT) {
+        poll_budget = std::numeric_limits<s32>::min();
+        return;
+    }
+
+    u64 now = slice_start + (static_cast<int64_t>(slice_budget) - budget);
+    if (deadline <= now) {
+        poll_budget = std::numeric_limits<s32>::max();
+    } else {
+        int64_t ahead = static_cast<int64_t>(std::min<u64>(deadline - now, u64{1} << 32));
+        poll_budget = static_cast<s32>(std::max<int64_t>(budget - ahead, std::numeric_limits<s32>::min()));
+    }
+}
+
+// Runs the events that are due, then takes a pending NMI or an unmasked IRQ
+template <CPU::Timing timing>
+void CPU::pollInterrupts(s32& budget, Memory& memory) {
+    clock_budget = budget;
+    if (scheduler) {
+        scheduler->runUntil(cycle());
+    }
+
+    Word vector = 0;
+    if (nmi_pending) {
+        nmi_pending = false;
+        vector = NMI_VECTOR;
+    } else if (irq_sources && !flags.I) {
+        vector = IRQ_VECTOR;
+    }
+
+    if (vector) {
+        s32 discarded = 0;
+        s32& cycles = handlerCycles<timing>(budget, discarded);
+        serviceInterrupt(cycles, memory, vector);
+        if constexpr (timing == Timing::Fast) {
+            budget -= 7;
+        } else if constexpr (timing == Timing::Instructions) {
+            budget--;
+        }
+        interrupts_taken++;
+    }
+    updatePollBudget(budget);
+}
+
+void CPU::serviceInterrupt(s32& clock_cycles, Memory& memory, Word vector) {
+    pushToStack(clock_cycles, memory, PC);
+
+    StatusFlags pushed = flags;
+    pushed.B = 0;
+    pushed.unused = 1;
+    pushToStack_8(clock_cycles, memory, packStatusFlags(pushed));
+    flags.I = 1;
+
+    Byte low = readByte(clock_cycles, memory, vector);
+    Byte high = readByte(clock_cycles, memory, vector + 1);
+    PC = (high << 8) | low;
+    clock_cycles--;
+}
+
+template <CPU::Timing timing, bool Instrumented>
+void CPU::runDispatchTable(s32 budget, Memory& memory) {
+    const s32 initial = budget;
+    const u64 trace_start = Instrumented && trace ? trace->cycles() : 0;
+    [[maybe_unused]] IdleLoop idle_loop;
+    beginSlice(budget);
+
+    while (budget > 0) {
+        if (budget <= poll_budget) {
+            pollInterrupts<timing>(budget, memory);
+            if (budget <= 0) {
+                break;
+            }
+        }
+        clock_budget = budget;
+        [[maybe_unused]] const s32 start = budget;
+        if constexpr (Instrumented) {
+            beforeInstruction(*this, memory, trace_start + (initial - budget));
+        }
+
+        s32 discarded = 0;
+        s32& cycles = handlerCycles<timing>(budget, discarded);
 
-    while (cycles > 0) {
         // Fetch
+        const Word instruction_pc = PC;
         Byte instruction = fetchByte(cycles, memory);
 
         // Decode
@@ -570,11 +1273,343 @@ void CPU::execute(s32 cycles, Memory& memory) {
         if (handler) {
             handler(*this, cycles, memory);
         } else {
-            memory.dumpMemoryToFile(0, Memory::MAX_MEMORY); // Dump full memory to file
-            throw InvalidInstructionException(PC -1);
+            invalidInstruction(memory);
+        }
+        chargeInstruction<timing>(budget, instruction);
+        checkIdleLoop<timing, Instrumented>(*this, instruction_pc, instruction, budget, memory, idle_loop);
+
+        if constexpr (Instrumented) {
+            afterInstruction(*this, instruction, start - budget);
+        }
+    }
+
+    if (Instrumented && trace) {
+        trace->advance(initial - budget);
+    }
+    endSlice(budget);
+}
+
+// The handlers and the CPU helpers they call live in this translation unit, so the compiler can
+// inline them into each case.
+template <CPU::Timing timing, bool Instrumented>
+void CPU::runSwitch(s32 budget, Memory& memory) {
+    const s32 initial = budget;
+    const u64 trace_start = Instrumented && trace ? trace->cycles() : 0;
+    [[maybe_unused]] IdleLoop idle_loop;
+    beginSlice(budget);
+
+    while (budget > 0) {
+        if (budget <= poll_budget) {
+            pollInterrupts<timing>(budget, memory);
+            if (budget <= 0) {
+                break;
+            }
+        }
+        clock_budget = budget;
+        [[maybe_unused]] const s32 start = budget;
+        if constexpr (Instrumented) {
+            beforeInstruction(*this, memory, trace_start + (initial - budget));
+        }
+
+        s32 discarded = 0;
+        s32& cycles = handlerCycles<timing>(budget, discarded);
+
+        const Word instruction_pc = PC;
+        Byte instruction = fetchByte(cycles, memory);
+
+        switch (instruction) {
+            #define EMULATOR_6502_SWITCH_CASE(opcode, handler, ...) case opcode: handler(*this, cycles, memory); break;
+            EMULATOR_6502_OPCODES(EMULATOR_6502_SWITCH_CASE)
+            #undef EMULATOR_6502_SWITCH_CASE
+
+            default:
+                invalidInstruction(memory);
+        }
+        chargeInstruction<timing>(budget, instruction);
+        checkIdleLoop<timing, Instrumented>(*this, instruction_pc, instruction, budget, memory, idle_loop);
+
+        if constexpr (Instrumented) {
+            afterInstruction(*this, instruction, start - budget);
+        }
+    }
+
+    if (Instrumented && trace) {
+        trace->advance(initial - budget);
+    }
+    endSlice(budget);
+}
+
+CPU::RunResult CPU::run(s32 budget, Memory& memory) {
+    return run<Timing::Exact>(budget, memory, RunOptions{});
+}
+
+CPU::RunResult CPU::run(s32 budget, Memory& memory, const RunOptions& options) {
+    return run<Timing::Exact>(budget, memory, options);
+}
+
+// Executes the budget on the selected core, checking the stop conditions between instructions
+template <CPU::Timing timing>
+CPU::RunResult CPU::run(s32 budget, Memory& memory, const RunOptions& options) {
+    const s32 initial = budget;
+    const bool instrumented = trace || profile || call_profile;
+    const u64 trace_start = trace ? trace->cycles() : 0;
+    const Breakpoints* breakpoints = options.breakpoints;
+    // Out of Word range when there is no halt address, so it never matches PC
+    const s32 halt_address = options.halt_address ? *options.halt_address : -1;
+
+    // Watchpoints are looked at only when there are some
+    const bool watching = memory.bus.watching();
+    RunResult result{ StopReason::Budget, 0, 0, {} };
+    Bus::WatchHit stale{};
+    memory.bus.takeWatchStop(stale);            // Drops hits left over from execute()
+    beginSlice(budget);
+
+    bool first = true;
+    while (budget > 0) {
+        if (budget <= poll_budget) {
+            pollInterrupts<timing>(budget, memory);
+            if (budget <= 0) {
+                break;
+            }
+        }
+        clock_budget = budget;
+        if (!first) {
+            if (watching) {
+                memory.bus.checkExecute(PC);
+                if (memory.bus.takeWatchStop(result.watch)) {
+                    result.reason = StopReason::Watchpoint;
+                    break;
+                }
+            }
+            if (breakpoints && breakpoints->test(PC)) {
+                result.reason = StopReason::Breakpoint;
+                break;
+            }
+            if (PC == halt_address) {
+                result.reason = StopReason::HaltAddress;
+                break;
+            }
+        }
+        if (options.callback && options.callback(*this, memory)) {
+            result.reason = StopReason::Callback;
+            break;
+        }
+
+        const s32 start = budget;
+        if (instrumented) {
+            beforeInstruction(*this, memory, trace_start + (initial - budget));
+        }
+
+        s32 discarded = 0;
+        s32& cycles = handlerCycles<timing>(budget, discarded);
+
+        Byte instruction = fetchByte(cycles, memory);
+
+        // Stops before the BRK or bad opcode, the fetch is taken back so nothing has changed
+        if (instruction == 0x00 && options.stop_on_brk && !first) {
+            PC--;
+            budget = start;
+            result.reason = StopReason::Break;
+            break;
+        }
+
+        bool valid = true;
+        if (core == Core::Switch) {
+            switch (instruction) {
+                #define EMULATOR_6502_SWITCH_CASE(opcode, handler, ...) case opcode: handler(*this, cycles, memory); break;
+                EMULATOR_6502_OPCODES(EMULATOR_6502_SWITCH_CASE)
+                #undef EMULATOR_6502_SWITCH_CASE
+
+                default:
+                    valid = false;
+            }
+        } else if (InstructionHandler handler = dispatch_table[instruction]) {
+            handler(*this, cycles, memory);
+        } else {
+            valid = false;
+        }
+
+        if (!valid) {
+            PC--;
+            budget = start;
+            dumpInvalidInstruction(memory);
+            result.reason = StopReason::InvalidOpcode;
+            break;
+        }
+        chargeInstruction<timing>(budget, instruction);
+        result.instructions++;
+        first = false;
+
+        if (instrumented) {
+            afterInstruction(*this, instruction, start - budget);
+        }
+
+        if (watching && memory.bus.takeWatchStop(result.watch)) {
+            result.reason = StopReason::Watchpoint;
+            break;
         }
     }
 
+    if (trace) {
+        trace->advance(initial - budget);
+    }
+    endSlice(budget);
+    result.cycles = initial - budget;
+    return result;
+}
+
+// A cached instruction skips the opcode fetch and goes straight into the switch. Anything that cannot
+// be cached runs the same way as on the dispatch table core
+template <CPU::Timing timing, bool Instrumented>
+void CPU::runDecoded(s32 budget, Memory& memory) {
+    const s32 initial = budget;
+    const u64 trace_start = Instrumented && trace ? trace->cycles() : 0;
+    DecodedCache& cache = memory.bus.decodedCache();
+    [[maybe_unused]] IdleLoop idle_loop;
+    beginSlice(budget);
+
+    while (budget > 0) {
+        if (budget <= poll_budget) {
+            pollInterrupts<timing>(budget, memory);
+            if (budget <= 0) {
+                break;
+            }
+        }
+        clock_budget = budget;
+        [[maybe_unused]] const s32 start = budget;
+        if constexpr (Instrumented) {
+            beforeInstruction(*this, memory, trace_start + (initial - budget));
+        }
+
+        s32 discarded = 0;
+        s32& cycles = handlerCycles<timing>(budget, discarded);
+
+        const Word instruction_pc = PC;
+        Byte instruction;
+        if (const DecodedInstruction* decoded = cache.lookup(PC, memory.bus)) {
+            // Instrumented runs see every instruction on its own
+            if (!Instrumented && decoded->fused != Superinstruction::None) {
+                runSuperinstruction<timing>(*this, decoded->fused, budget, memory);
+                checkIdleLoop<timing, Instrumented>(*this, instruction_pc, BRANCH_OPCODE, budget, memory, idle_loop);
+                continue;
+            }
+
+            // The opcode fetch, then the handler reads its operands as usual
+            instruction = decoded->opcode;
+            PC++;
+            cycles--;
+            switch (instruction) {
+                #define EMULATOR_6502_SWITCH_CASE(opcode, handler, ...) case opcode: handler(*this, cycles, memory); break;
+                EMULATOR_6502_OPCODES(EMULATOR_6502_SWITCH_CASE)
+                #undef EMULATOR_6502_SWITCH_CASE
+
+                default:
+                    break;  // Only valid opcodes are cached
+            }
+        } else {
+            instruction = fetchByte(cycles, memory);
+            InstructionHandler handler = dispatch_table[instruction];
+            if (handler) {
+                handler(*this, cycles, memory);
+            } else {
+                invalidInstruction(memory);
+            }
+        }
+        chargeInstruction<timing>(budget, instruction);
+        checkIdleLoop<timing, Instrumented>(*this, instruction_pc, instruction, budget, memory, idle_loop);
+
+        if constexpr (Instrumented) {
+            afterInstruction(*this, instruction, start - budget);
+        }
+    }
+
+    if (Instrumented && trace) {
+        trace->advance(initial - budget);
+    }
+    endSlice(budget);
+}
+
+// A block runs only when the budget covers it, otherwise the interpreter takes one instruction, so the
+// budget is checked before every instruction exactly as the other cores do
+void CPU::runJit(s32 budget, Memory& memory) {
+    JitCache& cache = memory.bus.jitCache();
+    IdleLoop idle_loop;
+    std::unique_ptr<JitVerifier> verifier;
+    if (jit_verify) {
+        verifier = std::make_unique<JitVerifier>(*this, memory);
+    }
+
+    beginSlice(budget);
+    while (budget > 0) {
+        if (budget <= poll_budget) {
+            pollInterrupts<Timing::Exact>(budget, memory);
+            if (budget <= 0) {
+                break;
+            }
+        }
+        clock_budget = budget;
+
+        Word start = PC;
+        // Only a block closed by a branch or JMP comes back to runJit at its own start
+        Byte closing = BRANCH_OPCODE;
+        const JitBlock& block = cache.lookup(PC, memory.bus);
+        // The block must also finish before the next poll, so interrupts are taken where they would be
+        if (block.code && budget > block.guard && budget - block.guard > poll_budget) {
+            JitExit exit = block.code(this, &memory, memory.bus.readMap(), budget);
+            budget -= exit.cycles;
+            if (verifier) {
+                verifier->check(*this, memory, exit.instructions, exit.cycles, start);
+            }
+        } else {
+            closing = memory.bus.peek(PC);
+            s32 cycles = runInstruction(memory);
+            budget -= cycles;
+            if (verifier) {
+                verifier->check(*this, memory, 1, cycles, start);
+            }
+        }
+        if (!verifier) {
+            checkIdleLoop<Timing::Exact, false>(*this, start, closing, budget, memory, idle_loop);
+        }
+    }
+    endSlice(budget);
+}
+
+template void CPU::execute<CPU::Timing::Exact>(s32, Memory&);
+template void CPU::execute<CPU::Timing::Fast>(s32, Memory&);
+template void CPU::execute<CPU::Timing::Instructions>(s32, Memory&);
+template u64 CPU::executeCycles<CPU::Timing::Exact>(u64, Memory&);
+template u64 CPU::executeCycles<CPU::Timing::Fast>(u64, Memory&);
+template u64 CPU::executeCycles<CPU::Timing::Instructions>(u64, Memory&);
+template void CPU::executeDispatchTable<CPU::Timing::Exact>(s32, Memory&);
+template void CPU::executeDispatchTable<CPU::Timing::Fast>(s32, Memory&);
+template void CPU::executeDispatchTable<CPU::Timing::Instructions>(s32, Memory&);
+template void CPU::executeSwitch<CPU::Timing::Exact>(s32, Memory&);
+template void CPU::executeSwitch<CPU::Timing::Fast>(s32, Memory&);
+template void CPU::executeSwitch<CPU::Timing::Instructions>(s32, Memory&);
+template void CPU::executeDecoded<CPU::Timing::Exact>(s32, Memory&);
+template void CPU::executeDecoded<CPU::Timing::Fast>(s32, Memory&);
+template void CPU::executeDecoded<CPU::Timing::Instructions>(s32, Memory&);
+template void CPU::executeJit<CPU::Timing::Exact>(s32, Memory&);
+template void CPU::executeJit<CPU::Timing::Fast>(s32, Memory&);
+template void CPU::executeJit<CPU::Timing::Instructions>(s32, Memory&);
+template CPU::RunResult CPU::run<CPU::Timing::Exact>(s32, Memory&, const RunOptions&);
+template CPU::RunResult CPU::run<CPU::Timing::Fast>(s32, Memory&, const RunOptions&);
+template CPU::RunResult CPU::run<CPU::Timing::Instructions>(s32, Memory&, const RunOptions&);
+
+// Dumps memory (unless turned off) and throws for the opcode that was just fetched
+void CPU::invalidInstruction(Memory& memory) {
+    dumpInvalidInstruction(memory);
+    throw InvalidInstructionException(PC -1);
+}
+
+// Writes the dump chosen by invalid_opcode_dump
+void CPU::dumpInvalidInstruction(Memory& memory) {
+    if (invalid_opcode_dump == InvalidOpcodeDump::Hex) {
+        memory.dumpMemoryToFile(0, Memory::MAX_MEMORY, Memory::DumpFormat::Hex);
+    } else if (invalid_opcode_dump == InvalidOpcodeDump::Binary) {
+        memory.dumpMemoryToFile(0, Memory::MAX_MEMORY, Memory::DumpFormat::Binary);
+    }
 }
 
 
@@ -595,6 +1630,7 @@ Word CPU::getIndirectYAddr(s32 &clock_cycles, Memory &memory) {
     Word useful_y_addr = useful_addr + Y_reg;
     if (useful_y_addr - useful_addr >= 0xFF) {
         clock_cycles--;
+        page_crossings++;
     }
     return useful_y_addr;
 }
@@ -612,6 +1648,7 @@ Word CPU::getAbsoluteAddrOffset(s32 &clock_cycles, Memory &memory, Byte& offset)
     const bool page_crossed = (abs_addr ^ abs_offset) >> 8;
     if (page_crossed) {
         clock_cycles--;
+        page_crossings++;
     }
     return abs_offset;
 }
@@ -657,7 +1694,7 @@ void CPU::pushToStack(s32 &clock_cycles, Memory &memory, Word value) {
 
 // Writes the value to the top of the stack as an 8-bit byte (2 CC)
 void CPU::pushToStack_8(s32 &clock_cycles, Memory &memory, Word value) {
-    memory[pointerToAddress()] = value;
+    memory.bus.write(pointerToAddress(), value);
     clock_cycles--;
     SP--;
     clock_cycles--;
@@ -676,7 +1713,7 @@ Byte CPU::popFromStack_8(s32 &clock_cycles, Memory &memory) {
     SP++;
     clock_cycles--;
 
-    Byte stack_value = memory[pointerToAddress()];
+    Byte stack_value = memory.bus.read(pointerToAddress());
     clock_cycles--;
     return stack_value;
 }
@@ -686,7 +1723,7 @@ Byte CPU::popFromStack_8(s32 &clock_cycles, Memory &memory) {
 // Sets the processor status flags for LD_ instructions
 void CPU::setRegisterFlag(Byte& reg) {
     flags.Z = (reg == 0);
-    flags.N = (reg & 0b1000000) > 0;
+    flags.N = (reg & 0b10000000) > 0;
 }
 
 // Loads the specified register with the value at the next memory address
@@ -1450,14 +2487,13 @@ void CPU::returnFromSubroutine(s32 &clock_cycles, Memory &memory) {
 
 
 // *** Branches ***
-// Todo: Note: If one is wrong they're ALL wrong!
 // If the carry flag is clear then add the relative displacement to the program counter to cause a branch to a new location.
 void CPU::branchCarryClear(s32 &clock_cycles, Memory &memory) {
     SByte value = fetchSByte(clock_cycles, memory);
 
-    if (!isBitSet(flags.C, carry_bit)) {
+    if (!flags.C) {
         // Carry bit is 0 -> Branch happens
-        Byte new_pc = PC + value;
+        Word new_pc = PC + value;
 
         if ((PC & 0xFF00) != (new_pc & 0xFF00)) {
             // Page Crossed
@@ -1466,6 +2502,7 @@ void CPU::branchCarryClear(s32 &clock_cycles, Memory &memory) {
 
         clock_cycles--;
         PC = new_pc;
+        branches_taken++;
     }
 }
 
@@ -1473,9 +2510,9 @@ void CPU::branchCarryClear(s32 &clock_cycles, Memory &memory) {
 void CPU::branchCarrySet(s32 &clock_cycles, Memory &memory) {
     SByte value = fetchSByte(clock_cycles, memory);
 
-    if (isBitSet(flags.C, carry_bit)) {
+    if (flags.C) {
         // Carry bit is 1 -> Branch happens
-        Byte new_pc = PC + value;
+        Word new_pc = PC + value;
 
         if ((PC & 0xFF00) != (new_pc & 0xFF00)) {
             // Page Crossed
@@ -1484,6 +2521,7 @@ void CPU::branchCarrySet(s32 &clock_cycles, Memory &memory) {
 
         clock_cycles--;
         PC = new_pc;
+        branches_taken++;
     }
 }
 
@@ -1491,9 +2529,9 @@ void CPU::branchCarrySet(s32 &clock_cycles, Memory &memory) {
 void CPU::branchIfEqual(s32 &clock_cycles, Memory &memory) {
     SByte value = fetchSByte(clock_cycles, memory);
 
-    if (isBitSet(flags.Z, zero_bit)) {
+    if (flags.Z) {
         // Zero flag is set -> branch happens
-        Byte new_pc = PC + value;
+        Word new_pc = PC + value;
 
         if ((PC & 0xFF00) != (new_pc & 0xFF00)) {
             // Page Crossed
@@ -1502,6 +2540,7 @@ void CPU::branchIfEqual(s32 &clock_cycles, Memory &memory) {
 
         clock_cycles--;
         PC = new_pc;
+        branches_taken++;
     }
 }
 
@@ -1509,9 +2548,9 @@ void CPU::branchIfEqual(s32 &clock_cycles, Memory &memory) {
 void CPU::branchIfMinus(s32 &clock_cycles, Memory &memory) {
     SByte value = fetchSByte(clock_cycles, memory);
 
-    if (isBitSet(flags.N, negative_bit)) {
+    if (flags.N) {
         // Negative flag is set -> branch happens
-        Byte new_pc = PC + value;
+        Word new_pc = PC + value;
 
         if ((PC & 0xFF00) != (new_pc & 0xFF00)) {
             // Page Crossed
@@ -1520,6 +2559,7 @@ void CPU::branchIfMinus(s32 &clock_cycles, Memory &memory) {
 
         clock_cycles--;
         PC = new_pc;
+        branches_taken++;
     }
 }
 
@@ -1527,9 +2567,9 @@ void CPU::branchIfMinus(s32 &clock_cycles, Memory &memory) {
 void CPU::branchNotEqual(s32 &clock_cycles, Memory &memory) {
     SByte value = fetchSByte(clock_cycles, memory);
 
-    if (!isBitSet(flags.Z, zero_bit)) {
+    if (!flags.Z) {
         // Zero flag is not set -> branch happens
-        Byte new_pc = PC + value;
+        Word new_pc = PC + value;
 
         if ((PC & 0xFF00) != (new_pc & 0xFF00)) {
             // Page Crossed
@@ -1538,6 +2578,7 @@ void CPU::branchNotEqual(s32 &clock_cycles, Memory &memory) {
 
         clock_cycles--;
         PC = new_pc;
+        branches_taken++;
     }
 }
 
@@ -1545,9 +2586,9 @@ void CPU::branchNotEqual(s32 &clock_cycles, Memory &memory) {
 void CPU::branchIfPositive(s32 &clock_cycles, Memory &memory) {
     SByte value = fetchSByte(clock_cycles, memory);
 
-    if (!isBitSet(flags.N, negative_bit)) {
+    if (!flags.N) {
         // Negative flag is not set -> branch happens
-        Byte new_pc = PC + value;
+        Word new_pc = PC + value;
 
         if ((PC & 0xFF00) != (new_pc & 0xFF00)) {
             // Page Crossed
@@ -1556,6 +2597,7 @@ void CPU::branchIfPositive(s32 &clock_cycles, Memory &memory) {
 
         clock_cycles--;
         PC = new_pc;
+        branches_taken++;
     }
 }
 
@@ -1563,9 +2605,9 @@ void CPU::branchIfPositive(s32 &clock_cycles, Memory &memory) {
 void CPU::branchIfOverflowClear(s32 &clock_cycles, Memory &memory) {
     SByte value = fetchSByte(clock_cycles, memory);
 
-    if (!isBitSet(flags.V, overflow_bit)) {
+    if (!flags.V) {
         // Overflow flag is not set -> branch happens
-        Byte new_pc = PC + value;
+        Word new_pc = PC + value;
 
         if ((PC & 0xFF00) != (new_pc & 0xFF00)) {
             // Page Crossed
@@ -1574,6 +2616,7 @@ void CPU::branchIfOverflowClear(s32 &clock_cycles, Memory &memory) {
 
         clock_cycles--;
         PC = new_pc;
+        branches_taken++;
     }
 }
 
@@ -1582,9 +2625,9 @@ void CPU::branchIfOverflowSet(s32 &clock_cycles, Memory &memory) {
     SByte value = fetchSByte(clock_cycles, memory);
 
 
-    if (isBitSet(flags.V, overflow_bit)) {
+    if (flags.V) {
         // Overflow flag is set -> branch happens
-        Byte new_pc = PC + value;
+        Word new_pc = PC + value;
 
         if ((PC & 0xFF00) != (new_pc & 0xFF00)) {
             // Page Crossed
@@ -1593,6 +2636,7 @@ void CPU::branchIfOverflowSet(s32 &clock_cycles, Memory &memory) {
 
         clock_cycles--;
         PC = new_pc;
+        branches_taken++;
     }
 }
 
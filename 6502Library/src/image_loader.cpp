@@ -0,0 +1,250 @@
+//
+// Loading program and ROM images from disk, mapped once and shared between machines
+//
+
+#include "../include/image_loader.h"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <stdexcept>
+
+#if !defined(_WIN32)
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+using namespace emulator_6502;
+
+namespace {
+
+    // Rounds a size up to a whole number of bus pages
+    size_t pageRound(size_t size) {
+        return (size + Bus::PAGE_SIZE - 1) / Bus::PAGE_SIZE * Bus::PAGE_SIZE;
+    }
+
+    ImageFormat detectFormat(const std::string& path) {
+        std::string extension = std::filesystem::path(path).extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(),
+                       [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+        if (extension == ".hex" || extension == ".ihx") {
+            return ImageFormat::IntelHex;
+        }
+        if (extension == ".prg") {
+            return ImageFormat::PRG;
+        }
+        return ImageFormat::Raw;
+    }
+
+    Byte hexByte(const Byte* text) {
+        auto digit = [](Byte c) -> int {
+            if (c >= '0' && c <= '9') return c - '0';
+            if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+            if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+            throw std::runtime_error("Invalid hex digit in Intel HEX image");
+        };
+        return static_cast<Byte>((digit(text[0]) << 4) | digit(text[1]));
+    }
+
+    // Decodes Intel HEX records into one block running from the lowest to the highest address written
+    // Gaps between records are left as 0x00
+    void parseIntelHex(const Byte* text, size_t size, std::vector<Byte>& out, Word& load_address) {
+        struct Record {
+            u32 address;
+            std::vector<Byte> bytes;
+        };
+        std::vector<Record> records;
+        u32 base = 0;
+        u32 lowest = Memory::MAX_MEMORY;
+        u32 highest = 0;
+
+        size_t position = 0;
+        while (position < size) {
+            if (std::isspace(text[position])) {
+                position++;
+                continue;
+            }
+            if (text[position] != ':' || position + 11 > size) {
+                throw std::runtime_error("Malformed Intel HEX record");
+            }
+
+            const Byte* record = text + position + 1;
+            Byte count = hexByte(record);
+            if (position + 11 + count * 2 > size) {
+                throw std::runtime_error("Truncated Intel HEX record");
+            }
+
+            Byte checksum = 0;
+            for (int i = 0; i < 5 + count; i++) {
+                checksum += hexByte(record + i * 2);
+            }
+            if (checksum != 0) {
+                throw std::runtime_error("Intel HEX checksum mismatch");
+            }
+
+            u32 offset = (hexByte(record + 2) << 8) | hexByte(record + 4);
+            Byte type = hexByte(record + 6);
+            const Byte* payload = record + 8;
+            position += 11 + count * 2;
+
+            if (type == 0x00) {
+                u32 address = base + offset;
+                if (address + count > Memory::MAX_MEMORY) {
+                    throw std::runtime_error("Intel HEX record outside the 64K address space");
+                }
+                Record data{ address, std::vector<Byte>(count) };
+                for (int i = 0; i < count; i++) {
+                    data.bytes[i] = hexByte(payload + i * 2);
+                }
+                if (count > 0) {
+                    lowest = std::min(lowest, address);
+                    highest = std::max(highest, address + count);
+                }
+                records.push_back(std::move(data));
+            } else if (type == 0x01) {
+                break;
+            } else if (type == 0x02 && count == 2) {
+                base = ((hexByte(payload) << 8) | hexByte(payload + 2)) << 4;
+            } else if (type == 0x04 && count == 2) {
+                base = ((hexByte(payload) << 8) | hexByte(payload + 2)) << 16;
+            }
+            // Start address records (03 / 05) are ignored, the CPU starts from the reset vector
+        }
+
+        if (records.empty() || lowest >= highest) {
+            throw std::runtime_error("Intel HEX image has no data");
+        }
+
+        out.assign(highest - lowest, 0x00);
+        for (const Record& record : records) {
+            std::copy(record.bytes.begin(), record.bytes.end(), out.begin() + (record.address - lowest));
+        }
+        load_address = static_cast<Word>(lowest);
+    }
+
+}
+
+// Reads the file and decodes it, raw and PRG images are used straight from the mapping where possible
+std::shared_ptr<const ProgramImage> ProgramImage::load(const std::string& path, ImageFormat format, Word load_address) {
+    std::shared_ptr<ProgramImage> image(new ProgramImage());
+    if (format == ImageFormat::Auto) {
+        format = detectFormat(path);
+    }
+
+    // The whole file, mapped where the platform allows it
+    const Byte* file = nullptr;
+    size_t file_size = 0;
+    size_t readable = 0;       // Bytes that can be read from 'file', the mapping is padded to a whole OS page
+    std::vector<Byte> contents;
+
+#if !defined(_WIN32)
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to open image: " + path);
+    }
+    struct stat info{};
+    if (::fstat(fd, &info) != 0 || info.st_size == 0) {
+        ::close(fd);
+        throw std::runtime_error("Image is empty or could not be read: " + path);
+    }
+    file_size = static_cast<size_t>(info.st_size);
+    void* mapping = ::mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("Unable to map image: " + path);
+    }
+    image->mapping = mapping;
+    image->mapping_size = file_size;
+
+    size_t os_page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    file = static_cast<const Byte*>(mapping);
+    readable = (file_size + os_page - 1) / os_page * os_page;
+#else
+    std::ifstream stream(path, std::ios::binary);
+    contents.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+    if (contents.empty()) {
+        throw std::runtime_error("Image is empty or could not be read: " + path);
+    }
+    file = contents.data();
+    file_size = contents.size();
+    readable = file_size;
+#endif
+
+    const Byte* bytes = file;
+    size_t length = file_size;
+    if (format == ImageFormat::PRG) {
+        if (file_size < 2) {
+            throw std::runtime_error("PRG image is missing its load address: " + path);
+        }
+        load_address = file[0] | (file[1] << 8);
+        bytes += 2;
+        length -= 2;
+    } else if (format == ImageFormat::IntelHex) {
+        parseIntelHex(file, file_size, image->owned, load_address);
+        bytes = nullptr;
+        length = image->owned.size();
+    }
+
+    if (load_address + length > Memory::MAX_MEMORY) {
+        throw std::runtime_error("Image does not fit in memory at its load address: " + path);
+    }
+    image->load_address = load_address;
+
+    // Mapping as ROM reads whole bus pages, copy if the last one would run past the readable bytes
+    if (bytes && bytes + pageRound(length) <= file + readable && contents.empty()) {
+        image->start = bytes;
+        image->length = length;
+    } else if (bytes) {
+        image->useBytes(bytes, length);
+    } else {
+        image->owned.resize(pageRound(length), 0x00);
+        image->start = image->owned.data();
+        image->length = length;
+    }
+
+    // Nothing points into the mapping any more
+    if (image->mapping && image->start != bytes) {
+#if !defined(_WIN32)
+        ::munmap(image->mapping, image->mapping_size);
+#endif
+        image->mapping = nullptr;
+    }
+    return image;
+}
+
+ProgramImage::~ProgramImage() {
+#if !defined(_WIN32)
+    if (mapping) {
+        ::munmap(mapping, mapping_size);
+    }
+#endif
+}
+
+// Maps the image read only through the bus
+void ProgramImage::mapROM(Memory& memory) const {
+    mapROM(memory, load_address);
+}
+
+void ProgramImage::mapROM(Memory& memory, Word address) const {
+    memory.bus.mapROM(address, static_cast<u32>(pageRound(length)), start, shared_from_this());
+}
+
+// Copies the image into memory as the CPU would see it written
+void ProgramImage::copyTo(Memory& memory) const {
+    copyTo(memory, load_address);
+}
+
+void ProgramImage::copyTo(Memory& memory, Word address) const {
+    memory.copyIn(address, start, length);
+}
+
+// Keeps a copy padded out to a whole number of bus pages
+void ProgramImage::useBytes(const Byte* bytes, size_t size) {
+    owned.assign(bytes, bytes + size);
+    owned.resize(pageRound(size), 0x00);
+    start = owned.data();
+    length = size;
+}
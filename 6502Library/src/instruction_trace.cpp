@@ -0,0 +1,116 @@
+//
+// Binary trace of executed instructions kept in a fixed size ring buffer
+//
+
+#include "../include/instruction_trace.h"
+
+#include <algorithm>
+
+using namespace emulator_6502;
+
+namespace {
+
+    size_t powerOfTwo(size_t value) {
+        size_t result = 1;
+        while (result < value) {
+            result <<= 1;
+        }
+        return result;
+    }
+
+}
+
+InstructionTrace::InstructionTrace(size_t capacity)
+    : records(std::make_unique<TraceRecord[]>(powerOfTwo(std::max<size_t>(capacity, 1)))),
+      mask(powerOfTwo(std::max<size_t>(capacity, 1)) - 1) {}
+
+// Copies the oldest records not yet drained
+size_t InstructionTrace::drain(TraceRecord* out, size_t max) {
+    u64 end = head.load(std::memory_order_acquire);
+    if (end - tail > capacity()) {
+        dropped_count += end - capacity() - tail;
+        tail = end - capacity();
+    }
+
+    u64 first = tail;
+    end = std::min<u64>(end, first + max);
+    size_t copied = copyFrom(first, end, out);
+    packFlags(out, copied);
+
+    dropped_count += (end - first) - copied;
+    tail = end;
+    return copied;
+}
+
+// Drains everything pending to the file
+size_t InstructionTrace::drainTo(std::FILE* file) {
+    TraceRecord chunk[1024];
+    size_t written = 0;
+    for (size_t count = drain(chunk, std::size(chunk)); count > 0; count = drain(chunk, std::size(chunk))) {
+        written += std::fwrite(chunk, sizeof(TraceRecord), count, file);
+    }
+    return written;
+}
+
+// Copies the newest records without draining them
+size_t InstructionTrace::last(TraceRecord* out, size_t count) const {
+    u64 end = head.load(std::memory_order_acquire);
+    u64 first = end - std::min<u64>({ end, count, capacity() });
+    size_t copied = copyFrom(first, end, out);
+    packFlags(out, copied);
+    return copied;
+}
+
+// Copies records [first, end) and drops any the producer overwrote while they were being copied
+// Returns how many were kept, they are moved to the start of 'out'
+size_t InstructionTrace::copyFrom(u64 first, u64 end, TraceRecord* out) const {
+    for (u64 index = first; index < end; index++) {
+        out[index - first] = records[index & mask];
+    }
+
+    // The producer may be writing the record at 'now', so it and the capacity - 1 records before it
+    // are the only ones guaranteed not to have been touched during the copy
+    std::atomic_thread_fence(std::memory_order_acquire);
+    u64 now = head.load(std::memory_order_relaxed);
+    u64 valid_from = now >= capacity() ? now - capacity() + 1 : 0;
+    if (valid_from <= first) {
+        return end - first;
+    }
+    if (valid_from >= end) {
+        return 0;
+    }
+
+    size_t skipped = valid_from - first;
+    std::move(out + skipped, out + (end - first), out);
+    return end - valid_from;
+}
+
+// Records hold the raw StatusFlags, the copies handed out get the packed status byte
+void InstructionTrace::packFlags(TraceRecord* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        CPU::StatusFlags flags{};
+        std::memcpy(&flags, &out[i].p, sizeof(flags));
+        out[i].p = CPU::packStatusFlags(flags);
+    }
+}
+
+// One line disassembly with the registers
+std::string InstructionTrace::format(const TraceRecord& record) {
+    const OpcodeInfo& info = opcode_table[record.opcode];
+    Byte length = info.handler ? operandBytes(info.mode) : 0;
+
+    char bytes[12];
+    if (length == 2) {
+        std::snprintf(bytes, sizeof(bytes), "%02X %02X %02X", record.opcode, record.operands[0], record.operands[1]);
+    } else if (length == 1) {
+        std::snprintf(bytes, sizeof(bytes), "%02X %02X", record.opcode, record.operands[0]);
+    } else {
+        std::snprintf(bytes, sizeof(bytes), "%02X", record.opcode);
+    }
+
+    char line[96];
+    std::snprintf(line, sizeof(line), "%04X  %-9s %-4s A:%02X X:%02X Y:%02X P:%02X SP:%02X  CYC:%llu",
+                  record.pc, bytes, info.mnemonic, record.a, record.x, record.y, record.p, record.sp,
+                  static_cast<unsigned long long>(record.cycle));
+    return line;
+}
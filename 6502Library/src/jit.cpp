@@ -0,0 +1,1478 @@
+//
+// Basic block translator to x86-64 machine code, used by the JIT core
+//
+
+#include "../include/jit.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <limits>
+
+#if EMULATOR_6502_JIT
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace emulator_6502;
+
+namespace {
+
+    constexpr size_t ARENA_SIZE = 4 << 20;
+    constexpr u32 MAX_BLOCK_INSTRUCTIONS = 64;
+    constexpr u32 ADDRESS_SPACE = Bus::PAGE_COUNT * Bus::PAGE_SIZE;
+
+#if EMULATOR_6502_JIT
+
+    // Host registers, numbered the way they are encoded
+    enum Reg : Byte {
+        RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+        R8 = 8, R9 = 9, R10 = 10, R11 = 11, R12 = 12, R13 = 13, R14 = 14, R15 = 15,
+        NO_REG = 0xFF
+    };
+
+    // Everything a block keeps for its whole run is in callee saved registers, so calls out of the
+    // block leave it alone. P and the flag table are caller saved and reloaded after each call
+    constexpr Reg CPU_POINTER = RBX;
+    constexpr Reg READ_MAP = R12;       // write_map follows it in Bus, see writeMapOffset
+    constexpr Reg BUDGET = R13;         // The execute budget, charged as each instruction finishes
+    constexpr Reg GUEST_A = R14;
+    constexpr Reg GUEST_X = R15;
+    constexpr Reg GUEST_Y = RBP;
+    constexpr Reg GUEST_P = R11;        // CPU::StatusFlags as it sits in memory
+    constexpr Reg FLAG_TABLE = R10;     // zeroNegativeTable()
+
+    // The frame below the saved registers
+    constexpr s32 MEMORY_SLOT = 0;          // Memory*
+    constexpr s32 INSTRUCTIONS_SLOT = 8;    // Run by the blocks chained through so far
+    constexpr s32 LEAVE_SLOT = 12;          // Set by a slow path after which the block has to return
+    constexpr s32 ENTRY_BUDGET_SLOT = 16;
+    constexpr s32 SAVED_RAX_SLOT = 20;      // eax and r8d are kept across slow path calls
+    constexpr s32 SAVED_R8_SLOT = 24;
+    constexpr s32 FRAME_SIZE = 40;          // Keeps calls 16 byte aligned after the six pushes
+
+    // Condition codes for jcc / setcc
+    enum Condition : Byte {
+        OVERFLOW = 0x0, CARRY = 0x2, NOT_CARRY = 0x3, EQUAL = 0x4, NOT_EQUAL = 0x5, LESS_OR_EQUAL = 0xE
+    };
+
+    // ALU operations, their opcode extension and the row of the 0x00 - 0x3F opcodes
+    enum AluOp : Byte {
+        ALU_ADD = 0, ALU_OR = 1, ALU_ADC = 2, ALU_AND = 4, ALU_SUB = 5, ALU_XOR = 6, ALU_CMP = 7
+    };
+
+    // Opcode extensions of the shift group
+    enum ShiftOp : Byte {
+        SHIFT_RCL = 2, SHIFT_RCR = 3, SHIFT_SHL = 4, SHIFT_SHR = 5
+    };
+
+    // [base + index * (1 << scale) + disp]
+    struct Mem {
+        Reg base;
+        s32 disp = 0;
+        Reg index = NO_REG;
+        Byte scale = 0;
+    };
+
+    // Just the encodings the translator needs
+    class Emitter {
+    public:
+        std::vector<Byte> bytes;
+
+        [[nodiscard]] size_t size() const { return bytes.size(); }
+
+        void push(Reg reg) {
+            if (reg >= 8) byte(0x41);
+            byte(0x50 + (reg & 7));
+        }
+        void pop(Reg reg) {
+            if (reg >= 8) byte(0x41);
+            byte(0x58 + (reg & 7));
+        }
+        void ret() { byte(0xC3); }
+
+        // mov dst, src
+        void mov32(Reg dst, Reg src) { instruction({ 0x89 }, false, src, dst, false); }
+        void mov64(Reg dst, Reg src) { instruction({ 0x89 }, true, src, dst, false); }
+        // mov dst, [mem] / mov [mem], src
+        void load32(Reg dst, const Mem& mem) { instruction({ 0x8B }, false, dst, mem, false); }
+        void load64(Reg dst, const Mem& mem) { instruction({ 0x8B }, true, dst, mem, false); }
+        void store32(const Mem& mem, Reg src) { instruction({ 0x89 }, false, src, mem, false); }
+        void store64(const Mem& mem, Reg src) { instruction({ 0x89 }, true, src, mem, false); }
+        // movzx dst, byte / word [mem]
+        void loadByte(Reg dst, const Mem& mem) { instruction({ 0x0F, 0xB6 }, false, dst, mem, false); }
+        void loadWord(Reg dst, const Mem& mem) { instruction({ 0x0F, 0xB7 }, false, dst, mem, false); }
+        // mov byte [mem], src8 / imm8
+        void storeByte(const Mem& mem, Reg src) { instruction({ 0x88 }, false, src, mem, true); }
+        void storeByte(const Mem& mem, Byte value) {
+            instruction({ 0xC6 }, false, 0, mem, false);
+            byte(value);
+        }
+        // mov word [mem], imm16
+        void storeWord(const Mem& mem, Word value) {
+            byte(0x66);
+            instruction({ 0xC7 }, false, 0, mem, false);
+            byte(value & 0xFF);
+            byte(value >> 8);
+        }
+        // mov word [mem], src16
+        void storeWord(const Mem& mem, Reg src) {
+            byte(0x66);
+            instruction({ 0x89 }, false, src, mem, false);
+        }
+        // mov dword [mem], imm32
+        void storeDword(const Mem& mem, u32 value) {
+            instruction({ 0xC7 }, false, 0, mem, false);
+            dword(value);
+        }
+        // movzx dst, src8 / src16
+        void zeroExtendByte(Reg dst, Reg src) { instruction({ 0x0F, 0xB6 }, false, dst, src, true); }
+        void zeroExtendWord(Reg dst, Reg src) { instruction({ 0x0F, 0xB7 }, false, dst, src, false); }
+        // mov dst32, imm
+        void moveImmediate(Reg dst, u32 value) {
+            if (dst >= 8) byte(0x41);
+            byte(0xB8 + (dst & 7));
+            dword(value);
+        }
+        // mov dst, imm64
+        void moveImmediate64(Reg dst, u64 value) {
+            byte(0x48 | (dst >> 3));
+            byte(0xB8 + (dst & 7));
+            qword(value);
+        }
+        // lea dst32, [mem]
+        void lea32(Reg dst, const Mem& mem) { instruction({ 0x8D }, false, dst, mem, false); }
+
+        // <op> dst, src
+        void alu32(AluOp op, Reg dst, Reg src) { instruction({ static_cast<Byte>(op * 8 + 1) }, false, src, dst, false); }
+        void alu64(AluOp op, Reg dst, Reg src) { instruction({ static_cast<Byte>(op * 8 + 1) }, true, src, dst, false); }
+        void alu8(AluOp op, Reg dst, Reg src) { instruction({ static_cast<Byte>(op * 8) }, false, src, dst, true); }
+        // <op> dst, [mem]
+        void alu32(AluOp op, Reg dst, const Mem& mem) { instruction({ static_cast<Byte>(op * 8 + 3) }, false, dst, mem, false); }
+        void alu8(AluOp op, Reg dst, const Mem& mem) { instruction({ static_cast<Byte>(op * 8 + 2) }, false, dst, mem, true); }
+        // <op> [mem], src
+        void alu64(AluOp op, const Mem& mem, Reg src) { instruction({ static_cast<Byte>(op * 8 + 1) }, true, src, mem, false); }
+        void alu8(AluOp op, const Mem& mem, Reg src) { instruction({ static_cast<Byte>(op * 8) }, false, src, mem, true); }
+        // <op> dst, imm
+        void alu32(AluOp op, Reg dst, s32 value) {
+            if (value >= -128 && value <= 127) {
+                instruction({ 0x83 }, false, op, dst, false);
+                byte(static_cast<Byte>(value));
+            } else {
+                instruction({ 0x81 }, false, op, dst, false);
+                dword(static_cast<u32>(value));
+            }
+        }
+        void alu8(AluOp op, Reg dst, Byte value) {
+            instruction({ 0x80 }, false, op, dst, true);
+            byte(value);
+        }
+        // <op> [mem], imm
+        void alu32(AluOp op, const Mem& mem, s32 value) {
+            if (value >= -128 && value <= 127) {
+                instruction({ 0x83 }, false, op, mem, false);
+                byte(static_cast<Byte>(value));
+            } else {
+                instruction({ 0x81 }, false, op, mem, false);
+                dword(static_cast<u32>(value));
+            }
+        }
+        void alu8(AluOp op, const Mem& mem, Byte value) {
+            instruction({ 0x80 }, false, op, mem, false);
+            byte(value);
+        }
+
+        // test a8, b8 / test reg8, imm8 / test reg, reg (64 bit)
+        void test8(Reg a, Reg b) { instruction({ 0x84 }, false, b, a, true); }
+        void test8(Reg reg, Byte value) {
+            instruction({ 0xF6 }, false, 0, reg, true);
+            byte(value);
+        }
+        void test64(Reg reg) { instruction({ 0x85 }, true, reg, reg, false); }
+        // inc / dec reg8, not reg8
+        void increment8(Reg reg, bool decrement) { instruction({ 0xFE }, false, decrement ? 1 : 0, reg, true); }
+        void not8(Reg reg) { instruction({ 0xF6 }, false, 2, reg, true); }
+        // inc / dec byte [mem], inc qword [mem]
+        void incrementMemory8(const Mem& mem, bool decrement) { instruction({ 0xFE }, false, decrement ? 1 : 0, mem, false); }
+        void incrementMemory64(const Mem& mem) { instruction({ 0xFF }, true, 0, mem, false); }
+        // <shift> reg8, 1 / <shift> reg8, imm8 / <shift> reg, imm8
+        void shift8(ShiftOp op, Reg reg) { instruction({ 0xD0 }, false, op, reg, true); }
+        void shift8(ShiftOp op, Reg reg, Byte amount) {
+            if (amount == 0) {
+                return;
+            }
+            instruction({ 0xC0 }, false, op, reg, true);
+            byte(amount);
+        }
+        void shift32(ShiftOp op, Reg reg, Byte amount) {
+            instruction({ 0xC1 }, false, op, reg, false);
+            byte(amount);
+        }
+        void shift64(ShiftOp op, Reg reg, Byte amount) {
+            instruction({ 0xC1 }, true, op, reg, false);
+            byte(amount);
+        }
+        // bt reg32, imm8
+        void bitTest32(Reg reg, Byte bit) {
+            instruction({ 0x0F, 0xBA }, false, 4, reg, false);
+            byte(bit);
+        }
+        // setcc reg8
+        void setCondition(Condition condition, Reg reg) {
+            instruction({ 0x0F, static_cast<Byte>(0x90 | condition) }, false, 0, reg, true);
+        }
+        // sub rsp, imm8 / add rsp, imm8
+        void adjustStack(s32 amount) {
+            byte(0x48);
+            byte(0x83);
+            byte(amount < 0 ? 0xEC : 0xC4);
+            byte(static_cast<Byte>(amount < 0 ? -amount : amount));
+        }
+        void call(const void* function) {
+            moveImmediate64(RAX, reinterpret_cast<u64>(function));
+            byte(0xFF);
+            byte(0xD0);
+        }
+        // jmp reg
+        void jumpRegister(Reg reg) { instruction({ 0xFF }, false, 4, reg, false); }
+
+        // Jumps with a 32 bit displacement to fill in later, the returned position goes to bind()
+        size_t jump() {
+            byte(0xE9);
+            dword(0);
+            return size() - 4;
+        }
+        size_t jumpIf(Condition condition) {
+            byte(0x0F);
+            byte(0x80 | condition);
+            dword(0);
+            return size() - 4;
+        }
+        // Jumps to code already emitted
+        void jumpTo(size_t target) {
+            byte(0xE9);
+            dword(static_cast<u32>(static_cast<s32>(target - (size() + 4))));
+        }
+        // Points the jump at the current position
+        void bind(size_t displacement) {
+            s32 relative = static_cast<s32>(size() - (displacement + 4));
+            std::memcpy(&bytes[displacement], &relative, sizeof(relative));
+        }
+
+    private:
+        void byte(Byte value) { bytes.push_back(value); }
+        void dword(u32 value) {
+            for (int shift = 0; shift < 32; shift += 8) byte(static_cast<Byte>(value >> shift));
+        }
+        void qword(u64 value) {
+            for (int shift = 0; shift < 64; shift += 8) byte(static_cast<Byte>(value >> shift));
+        }
+
+        // spl / bpl / sil / dil need a REX prefix to be addressed as bytes. 'reg' is a register or an
+        // opcode extension, a prefix it does not need is harmless
+        static bool isByteHigh(Byte reg) { return reg >= 4 && reg < 8; }
+
+        void instruction(std::initializer_list<Byte> opcode, bool wide, Byte reg, Reg rm, bool byte_registers) {
+            Byte rex = 0x40 | (wide ? 0x08 : 0) | (((reg >> 3) & 1) << 2) | ((rm >> 3) & 1);
+            if (rex != 0x40 || (byte_registers && (isByteHigh(reg) || isByteHigh(rm)))) {
+                byte(rex);
+            }
+            for (Byte value : opcode) byte(value);
+            byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+        }
+
+        // Always with a displacement, so rbp and r13 need no special case as the base
+        void instruction(std::initializer_list<Byte> opcode, bool wide, Byte reg, const Mem& mem, bool byte_registers) {
+            bool indexed = mem.index != NO_REG;
+            Byte rex = 0x40 | (wide ? 0x08 : 0) | (((reg >> 3) & 1) << 2) |
+                       (indexed ? ((mem.index >> 3) & 1) << 1 : 0) | ((mem.base >> 3) & 1);
+            if (rex != 0x40 || (byte_registers && isByteHigh(reg))) {
+                byte(rex);
+            }
+            for (Byte value : opcode) byte(value);
+
+            bool short_displacement = mem.disp >= -128 && mem.disp <= 127;
+            Byte mod = short_displacement ? 0x40 : 0x80;
+            if (!indexed && (mem.base & 7) != RSP) {
+                byte(mod | ((reg & 7) << 3) | (mem.base & 7));
+            } else {
+                byte(mod | ((reg & 7) << 3) | RSP);
+                byte((mem.scale << 6) | (((indexed ? mem.index : RSP) & 7) << 3) | (mem.base & 7));
+            }
+            if (short_displacement) {
+                byte(static_cast<Byte>(mem.disp));
+            } else {
+                dword(static_cast<u32>(mem.disp));
+            }
+        }
+    };
+
+    // Bit of each flag inside CPU::StatusFlags as it sits in memory
+    struct FlagMasks {
+        Byte C, Z, I, D, V, N;
+    };
+
+    template <typename Set>
+    Byte flagMask(Set set) {
+        static_assert(sizeof(CPU::StatusFlags) == 1, "The JIT keeps the flags as one byte");
+        CPU::StatusFlags flags{};
+        set(flags);
+        Byte mask;
+        std::memcpy(&mask, &flags, sizeof(mask));
+        return mask;
+    }
+
+    const FlagMasks& flagMasks() {
+        static const FlagMasks masks{
+            flagMask([](CPU::StatusFlags& flags) { flags.C = 1; }),
+            flagMask([](CPU::StatusFlags& flags) { flags.Z = 1; }),
+            flagMask([](CPU::StatusFlags& flags) { flags.I = 1; }),
+            flagMask([](CPU::StatusFlags& flags) { flags.D = 1; }),
+            flagMask([](CPU::StatusFlags& flags) { flags.V = 1; }),
+            flagMask([](CPU::StatusFlags& flags) { flags.N = 1; }),
+        };
+        return masks;
+    }
+
+    Byte shiftOf(Byte mask) {
+        return static_cast<Byte>(__builtin_ctz(mask));
+    }
+
+    // Z and N for every value, or'd into P with one load
+    const std::array<Byte, 256>& zeroNegativeTable() {
+        static const std::array<Byte, 256> table = [] {
+            const FlagMasks& f = flagMasks();
+            std::array<Byte, 256> bits{};
+            for (u32 value = 0; value < bits.size(); value++) {
+                bits[value] = (value == 0 ? f.Z : 0) | ((value & 0x80) ? f.N : 0);
+            }
+            return bits;
+        }();
+        return table;
+    }
+
+    // P as PHP pushes it, for every P
+    const std::array<Byte, 256>& packTable() {
+        static const std::array<Byte, 256> table = [] {
+            std::array<Byte, 256> packed{};
+            for (u32 bits = 0; bits < packed.size(); bits++) {
+                CPU::StatusFlags flags{};
+                Byte byte = static_cast<Byte>(bits);
+                std::memcpy(&flags, &byte, sizeof(byte));
+                packed[bits] = CPU::packStatusFlags(flags);
+            }
+            return packed;
+        }();
+        return table;
+    }
+
+    // P as PLP leaves it, for every byte pulled
+    const std::array<Byte, 256>& unpackTable() {
+        static const std::array<Byte, 256> table = [] {
+            std::array<Byte, 256> unpacked{};
+            for (u32 value = 0; value < unpacked.size(); value++) {
+                CPU::StatusFlags flags = CPU::unpackStatusFlags(static_cast<Byte>(value));
+                flags.unused = 1;
+                std::memcpy(&unpacked[value], &flags, sizeof(Byte));
+            }
+            return unpacked;
+        }();
+        return table;
+    }
+
+    // Where the fields the blocks touch sit inside CPU
+    struct CpuLayout {
+        s32 pc, sp, a, x, y, flags, clock_budget, poll_budget, page_crossings, branches_taken;
+    };
+
+    const CpuLayout& cpuLayout() {
+        static const CpuLayout layout = [] {
+            CPU probe{};
+            auto at = [&probe](const void* field) {
+                return static_cast<s32>(static_cast<const Byte*>(field) - reinterpret_cast<const Byte*>(&probe));
+            };
+            return CpuLayout{ at(&probe.PC), at(&probe.SP), at(&probe.Accumulator), at(&probe.X_reg),
+                              at(&probe.Y_reg), at(&probe.flags), at(&probe.clock_budget), at(&probe.poll_budget),
+                              at(&probe.page_crossings), at(&probe.branches_taken) };
+        }();
+        return layout;
+    }
+
+    // What each handler charges, found by running it, so blocks charge exactly what the interpreter
+    // does, its quirks included. Every operand is tried at 0x10 and 0xF0 with X and Y at 0 and 0xFF and
+    // all flags clear and set, which takes every branch both ways and every indexed mode across a page
+    struct HandlerTiming {
+        std::array<s32, OPCODE_COUNT> cycles{};     // The cheapest, no branch taken and no page crossed
+        std::array<s32, OPCODE_COUNT> worst{};
+        std::array<Byte, OPCODE_COUNT> length{};    // Bytes PC moves on by when the instruction does not jump
+    };
+
+    const HandlerTiming& handlerTiming() {
+        static const HandlerTiming timing = [] {
+            constexpr Word PROBE_PC = 0x0200;
+            HandlerTiming probed;
+            auto memory = std::make_unique<Memory>();
+            std::vector<Byte> image(Memory::MAX_MEMORY);
+
+            for (u32 opcode = 0; opcode < OPCODE_COUNT; opcode++) {
+                if (!dispatch_table[opcode]) {
+                    continue;
+                }
+                probed.cycles[opcode] = std::numeric_limits<s32>::max();
+                for (Byte fill : { 0x10, 0xF0 }) {
+                    std::fill(image.begin(), image.end(), fill);
+                    image[PROBE_PC] = static_cast<Byte>(opcode);
+                    for (Byte index : { 0x00, 0xFF }) {
+                        for (Byte status : { 0x00, 0xFF }) {
+                            memory->copyIn(image.data());
+                            CPU cpu{};
+                            cpu.PC = PROBE_PC;
+                            cpu.SP = 0xFD;
+                            cpu.X_reg = index;
+                            cpu.Y_reg = index;
+                            cpu.flags = CPU::unpackStatusFlags(status);
+                            s32 cycles = cpu.runInstruction(*memory);
+
+                            probed.cycles[opcode] = std::min(probed.cycles[opcode], cycles);
+                            probed.worst[opcode] = std::max(probed.worst[opcode], cycles);
+                            if (fill == 0x10 && index == 0 && status == 0) {
+                                probed.length[opcode] = static_cast<Byte>(cpu.PC - PROBE_PC);
+                            }
+                        }
+                    }
+                }
+            }
+            return probed;
+        }();
+        return timing;
+    }
+
+    // Where write_map sits from read_map, blocks reach both through one register
+    s32 writeMapOffset(const Bus& bus) {
+        return static_cast<s32>(reinterpret_cast<const Byte*>(bus.writeMap()) - reinterpret_cast<const Byte*>(bus.readMap()));
+    }
+
+    // Code was invalidated, or an interrupt or scheduler event came due: the block has to return
+    bool mustLeave(const CPU* cpu, const Bus& bus, u64 generation, s32 poll_budget) {
+        return bus.codeGeneration() != generation || cpu->poll_budget != poll_budget;
+    }
+
+    // Slow path accesses, called from the blocks with clock_budget up to date so devices see the right
+    // cycle(). Reads return the byte with bit 8 set when the block has to return, writes just that flag
+    u32 jitRead(CPU* cpu, Memory* memory, u32 address) {
+        u64 generation = memory->bus.codeGeneration();
+        s32 poll_budget = cpu->poll_budget;
+        Byte value = memory->bus.read(static_cast<Word>(address));
+        return value | (mustLeave(cpu, memory->bus, generation, poll_budget) ? 0x100 : 0);
+    }
+
+    u32 jitWrite(CPU* cpu, Memory* memory, u32 address, u32 value) {
+        u64 generation = memory->bus.codeGeneration();
+        s32 poll_budget = cpu->poll_budget;
+        memory->bus.write(static_cast<Word>(address), static_cast<Byte>(value));
+        return mustLeave(cpu, memory->bus, generation, poll_budget);
+    }
+
+    // Runs the instruction at pc through its handler, as runInstruction does. Returns its cycles, with
+    // bit 32 set when the block has to return, which includes PC not ending up at 'next'. A 'next'
+    // outside the address space takes PC going anywhere
+    u64 jitInterpret(CPU* cpu, Memory* memory, InstructionHandler handler, u32 pc, u32 next) {
+        u64 generation = memory->bus.codeGeneration();
+        s32 poll_budget = cpu->poll_budget;
+        cpu->PC = static_cast<Word>(pc + 1);
+        s32 cycles = -1;    // The opcode fetch
+        handler(*cpu, cycles, *memory);
+        bool leave = (next < ADDRESS_SPACE && cpu->PC != next) || mustLeave(cpu, memory->bus, generation, poll_budget);
+        return static_cast<u32>(-cycles) | (static_cast<u64>(leave) << 32);
+    }
+
+    // How each opcode is emitted
+    enum class Kind : Byte {
+        Interpret,      // Calls the handler, for the forms with quirks or too rare to be worth emitting
+        InterpretJump,  // JMP indirect, RTI and BRK, the same but PC goes somewhere else
+        Load,           // LDA / LDX / LDY
+        Store,          // STA / STX / STY
+        Logic,          // AND / EOR / ORA
+        Add,            // ADC / SBC
+        Compare,        // CMP / CPX / CPY
+        BitTest,        // BIT
+        Shift,          // ASL / LSR / ROL / ROR
+        Modify,         // INC / DEC
+        Step,           // INX / INY / DEX / DEY
+        Transfer,       // TAX / TAY / TXA / TYA / TSX / TXS
+        Flag,           // CLC / SEC / CLI / SEI / CLD / SED / CLV
+        Nop,
+        Push,           // PHA / PHP
+        Pull,           // PLA / PLP
+        Branch,
+        Jump,           // JMP absolute
+        Call,           // JSR
+        Return          // RTS
+    };
+
+    enum class ShiftKind : Byte {
+        ASL, LSR, ROL, ROR
+    };
+
+    struct Translation {
+        Kind kind = Kind::Interpret;
+        Reg reg = GUEST_A;
+        // Logic: the host operation. Shift: the ShiftKind. Transfer: the Reg copied to, with reg the one
+        // copied from and NO_REG standing for SP
+        Byte op = 0;
+        // Flag instructions and branches: which flag, and whether it is set / tested for being set.
+        // ADC / SBC: set for SBC. Step and Modify: set to decrement. Push and Pull: set for P
+        Byte flag = 0;
+        bool set = false;
+        // Absolute logic ops, ADC / SBC, compares, shifts and BIT read from the zero page, the handlers
+        // keep the address in a Byte
+        bool zero_page_address = false;
+    };
+
+    Translation translationFor(Byte opcode) {
+        const FlagMasks& f = flagMasks();
+        const Byte asl = static_cast<Byte>(ShiftKind::ASL);
+        const Byte lsr = static_cast<Byte>(ShiftKind::LSR);
+        const Byte rol = static_cast<Byte>(ShiftKind::ROL);
+        const Byte ror = static_cast<Byte>(ShiftKind::ROR);
+        switch (opcode) {
+            case 0xA9: case 0xA5: case 0xAD: case 0xB5: case 0xBD: case 0xB9: return { Kind::Load, GUEST_A };
+            case 0xA2: case 0xA6: case 0xAE: case 0xB6: case 0xBE: return { Kind::Load, GUEST_X };
+            case 0xA0: case 0xA4: case 0xAC: case 0xB4: case 0xBC: return { Kind::Load, GUEST_Y };
+            case 0x85: case 0x8D: case 0x9D: case 0x99: return { Kind::Store, GUEST_A };
+            case 0x86: case 0x8E: return { Kind::Store, GUEST_X };
+            case 0x84: case 0x8C: return { Kind::Store, GUEST_Y };
+            case 0x29: case 0x25: return { Kind::Logic, GUEST_A, ALU_AND };
+            case 0x2D: return { Kind::Logic, GUEST_A, ALU_AND, 0, false, true };
+            case 0x49: case 0x45: return { Kind::Logic, GUEST_A, ALU_XOR };
+            case 0x4D: return { Kind::Logic, GUEST_A, ALU_XOR, 0, false, true };
+            case 0x09: case 0x05: return { Kind::Logic, GUEST_A, ALU_OR };
+            case 0x0D: return { Kind::Logic, GUEST_A, ALU_OR, 0, false, true };
+            case 0x69: case 0x65: return { Kind::Add, GUEST_A, 0, 0, false };
+            case 0x6D: return { Kind::Add, GUEST_A, 0, 0, false, true };
+            case 0xE9: case 0xE5: return { Kind::Add, GUEST_A, 0, 0, true };
+            case 0xED: return { Kind::Add, GUEST_A, 0, 0, true, true };
+            case 0xC9: case 0xC5: return { Kind::Compare, GUEST_A };
+            case 0xCD: return { Kind::Compare, GUEST_A, 0, 0, false, true };
+            case 0xE0: case 0xE4: return { Kind::Compare, GUEST_X };
+            case 0xEC: return { Kind::Compare, GUEST_X, 0, 0, false, true };
+            case 0xC0: case 0xC4: return { Kind::Compare, GUEST_Y };
+            case 0xCC: return { Kind::Compare, GUEST_Y, 0, 0, false, true };
+            case 0x24: case 0x2C: return { Kind::BitTest, GUEST_A, 0, 0, false, true };
+            case 0x0A: case 0x06: return { Kind::Shift, GUEST_A, asl };
+            case 0x0E: return { Kind::Shift, GUEST_A, asl, 0, false, true };
+            case 0x4A: case 0x46: return { Kind::Shift, GUEST_A, lsr };
+            case 0x4E: return { Kind::Shift, GUEST_A, lsr, 0, false, true };
+            case 0x2A: case 0x26: return { Kind::Shift, GUEST_A, rol };
+            case 0x2E: return { Kind::Shift, GUEST_A, rol, 0, false, true };
+            case 0x6A: case 0x66: return { Kind::Shift, GUEST_A, ror };
+            case 0x6E: return { Kind::Shift, GUEST_A, ror, 0, false, true };
+            case 0xE6: case 0xEE: return { Kind::Modify, GUEST_A, 0, 0, false };
+            case 0xC6: case 0xCE: return { Kind::Modify, GUEST_A, 0, 0, true };
+            case 0xE8: return { Kind::Step, GUEST_X, 0, 0, false };
+            case 0xC8: return { Kind::Step, GUEST_Y, 0, 0, false };
+            case 0xCA: return { Kind::Step, GUEST_X, 0, 0, true };
+            case 0x88: return { Kind::Step, GUEST_Y, 0, 0, true };
+            case 0x18: return { Kind::Flag, GUEST_A, 0, f.C, false };
+            case 0x38: return { Kind::Flag, GUEST_A, 0, f.C, true };
+            case 0x58: return { Kind::Flag, GUEST_A, 0, f.I, false };
+            case 0x78: return { Kind::Flag, GUEST_A, 0, f.I, true };
+            case 0xD8: return { Kind::Flag, GUEST_A, 0, f.D, false };
+            case 0xF8: return { Kind::Flag, GUEST_A, 0, f.D, true };
+            case 0xB8: return { Kind::Flag, GUEST_A, 0, f.V, false };
+            case 0xAA: return { Kind::Transfer, GUEST_A, GUEST_X };
+            case 0xA8: return { Kind::Transfer, GUEST_A, GUEST_Y };
+            case 0x8A: return { Kind::Transfer, GUEST_X, GUEST_A };
+            case 0x98: return { Kind::Transfer, GUEST_Y, GUEST_A };
+            case 0xBA: return { Kind::Transfer, NO_REG, GUEST_X };
+            case 0x9A: return { Kind::Transfer, GUEST_X, NO_REG };
+            case 0xEA: return { Kind::Nop };
+            case 0x48: return { Kind::Push };
+            case 0x08: return { Kind::Push, GUEST_A, 0, 0, true };
+            case 0x68: return { Kind::Pull };
+            case 0x28: return { Kind::Pull, GUEST_A, 0, 0, true };
+            case 0x90: return { Kind::Branch, GUEST_A, 0, f.C, false };
+            case 0xB0: return { Kind::Branch, GUEST_A, 0, f.C, true };
+            case 0xF0: return { Kind::Branch, GUEST_A, 0, f.Z, true };
+            case 0xD0: return { Kind::Branch, GUEST_A, 0, f.Z, false };
+            case 0x30: return { Kind::Branch, GUEST_A, 0, f.N, true };
+            case 0x10: return { Kind::Branch, GUEST_A, 0, f.N, false };
+            case 0x70: return { Kind::Branch, GUEST_A, 0, f.V, true };
+            case 0x50: return { Kind::Branch, GUEST_A, 0, f.V, false };
+            case 0x4C: return { Kind::Jump };
+            case 0x20: return { Kind::Call };
+            case 0x60: return { Kind::Return };
+            case 0x6C: case 0x40: case 0x00: return { Kind::InterpretJump };
+            default:   return {};
+        }
+    }
+
+    bool endsBlock(Kind kind) {
+        switch (kind) {
+            case Kind::InterpretJump:
+            case Kind::Branch:
+            case Kind::Jump:
+            case Kind::Call:
+            case Kind::Return:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    struct Instruction {
+        Word pc;
+        Byte opcode;
+        Word operand;
+        Byte length;
+        Translation translation;
+    };
+
+    // Emits one block. Exits and slow paths are collected while the body is emitted and placed after
+    // it, so the body runs straight through
+    //
+    // The block has two ways in: the prologue, called by runJit, and the chain entry after it, jumped to
+    // by blocks that end where this one starts. The chain entry makes the same budget and poll checks
+    // runJit does before calling a block, and returns when they fail
+    class BlockEmitter {
+    public:
+        BlockEmitter(Word start, Byte* const* entries, s32 write_map_offset)
+            : start(start), entries(entries), write_map_offset(write_map_offset),
+              f(flagMasks()), layout(cpuLayout()), timing(handlerTiming()) {}
+
+        std::vector<Byte> emit(const std::vector<Instruction>& instructions, Word end, s32 guard, bool idle,
+                               size_t& chain_entry) {
+            prologue();
+
+            chain_entry = e.size();
+            chain_start = chain_entry;
+            // Returning to runJit from a self loop it may skip as idle lets it look at the loop
+            self_chain = !idle;
+            e.alu32(ALU_CMP, BUDGET, guard);
+            size_t over_budget = e.jumpIf(LESS_OR_EQUAL);
+            e.lea32(RAX, Mem{ BUDGET, -guard });
+            e.alu32(ALU_CMP, RAX, Mem{ CPU_POINTER, layout.poll_budget });
+            exits.push_back(Exit{ { over_budget, e.jumpIf(LESS_OR_EQUAL) }, start, 0 });
+
+            u32 count = 0;
+            for (const Instruction& instruction : instructions) {
+                count++;
+                emitInstruction(instruction, count);
+            }
+
+            const Translation& last = instructions.back().translation;
+            if (!endsBlock(last.kind)) {
+                exits.push_back(Exit{ { e.jump() }, end, count, 0, false, true });
+            }
+
+            for (const Exit& exit : exits) {
+                emitExit(exit);
+            }
+            for (size_t jump : returns) {
+                e.bind(jump);
+            }
+            epilogue();
+            for (const std::function<void()>& slow_path : slow_paths) {
+                slow_path();
+            }
+            return std::move(e.bytes);
+        }
+
+    private:
+        struct Exit {
+            std::vector<size_t> jumps;
+            Word pc;
+            u32 instructions;
+            s32 penalty = 0;            // Cycles still to charge, a taken branch's
+            bool branch_taken = false;
+            bool chain = false;         // Jumps on into the block at pc if there is one
+            bool dynamic = false;       // PC is already stored, 'pc' is unused
+        };
+
+        Emitter e;
+        const Word start;
+        Byte* const* const entries;
+        const s32 write_map_offset;
+        const FlagMasks& f;
+        const CpuLayout& layout;
+        const HandlerTiming& timing;
+
+        size_t chain_start = 0;
+        bool self_chain = true;
+        bool slow = false;              // The current instruction has a slow path that may ask to leave
+        std::vector<Exit> exits;
+        std::vector<size_t> returns;    // Jumps to the epilogue, with edx the instructions to add
+        std::vector<std::function<void()>> slow_paths;
+
+        void emitInstruction(const Instruction& instruction, u32 count) {
+            const Translation& t = instruction.translation;
+            AddressingMode mode = opcode_table[instruction.opcode].mode;
+            Word next = static_cast<Word>(instruction.pc + instruction.length);
+            Word address = t.zero_page_address ? (instruction.operand & 0xFF) : instruction.operand;
+            Byte value = static_cast<Byte>(instruction.operand);
+            s32 cycles = timing.cycles[instruction.opcode];
+            slow = false;
+
+            switch (t.kind) {
+                case Kind::Interpret:
+                case Kind::InterpretJump:
+                    interpret(instruction, count);
+                    return;
+                case Kind::Load:
+                    if (mode == AddressingMode::Immediate) {
+                        e.moveImmediate(t.reg, value);
+                        setZeroNegative(value);
+                    } else if (mode == AddressingMode::AbsoluteX || mode == AddressingMode::AbsoluteY) {
+                        // loadAbsOffsetRegister sets no flags
+                        absoluteIndexed(instruction.operand, mode);
+                        pageCrossing(instruction.operand);
+                        readDynamic();
+                        e.mov32(t.reg, RCX);
+                        chargePageCrossing();
+                    } else {
+                        if (mode == AddressingMode::ZeroPageX || mode == AddressingMode::ZeroPageY) {
+                            e.lea32(RAX, Mem{ mode == AddressingMode::ZeroPageX ? GUEST_X : GUEST_Y, value });
+                            e.zeroExtendByte(RAX, RAX);
+                            readDynamic();
+                        } else {
+                            readStatic(address);
+                        }
+                        e.mov32(t.reg, RCX);
+                        setZeroNegative(t.reg);
+                    }
+                    break;
+                case Kind::Store:
+                    if (mode == AddressingMode::AbsoluteX || mode == AddressingMode::AbsoluteY) {
+                        absoluteIndexed(instruction.operand, mode);
+                        writeDynamic(t.reg);
+                    } else {
+                        writeStatic(address, t.reg);
+                    }
+                    break;
+                case Kind::Logic:
+                    if (mode == AddressingMode::Immediate) {
+                        e.alu8(static_cast<AluOp>(t.op), t.reg, value);
+                    } else {
+                        readStatic(address);
+                        e.alu8(static_cast<AluOp>(t.op), t.reg, RCX);
+                    }
+                    setZeroNegative(t.reg);
+                    break;
+                case Kind::Add:
+                    add(mode == AddressingMode::Immediate, value, address, t.set);
+                    break;
+                case Kind::Compare:
+                    compare(t.reg, mode == AddressingMode::Immediate, value, address);
+                    break;
+                case Kind::BitTest:
+                    bitTest(address);
+                    break;
+                case Kind::Shift:
+                    if (mode == AddressingMode::Accumulator) {
+                        shift(static_cast<ShiftKind>(t.op), GUEST_A);
+                    } else {
+                        // The memory forms only set the flags, the handlers never write the result back
+                        readStatic(address);
+                        shift(static_cast<ShiftKind>(t.op), RCX);
+                    }
+                    break;
+                case Kind::Modify:
+                    readStatic(address);
+                    e.increment8(RCX, t.set);
+                    setZeroNegative(RCX);
+                    writeStatic(address, RCX);
+                    break;
+                case Kind::Step:
+                    e.increment8(t.reg, t.set);
+                    setZeroNegative(t.reg);
+                    break;
+                case Kind::Flag:
+                    if (t.set) {
+                        e.alu32(ALU_OR, GUEST_P, t.flag);
+                    } else {
+                        clearFlags(t.flag);
+                    }
+                    break;
+                case Kind::Transfer: {
+                    // transferRegister copies the byte at the source's value to the destination's value,
+                    // leaving both registers as they were
+                    Reg to = static_cast<Reg>(t.op);
+                    registerValue(RAX, t.reg);
+                    readDynamic();
+                    registerValue(RAX, to);
+                    writeDynamic(RCX);
+                    setZeroNegative(RAX);
+                    break;
+                }
+                case Kind::Nop:
+                    break;
+                case Kind::Push:
+                    if (t.set) {
+                        e.moveImmediate64(RDX, reinterpret_cast<u64>(packTable().data()));
+                        e.loadByte(RCX, Mem{ RDX, 0, GUEST_P });
+                    }
+                    stackAddress(0);
+                    writeDynamic(t.set ? RCX : GUEST_A);
+                    e.incrementMemory8(Mem{ CPU_POINTER, layout.sp }, true);
+                    break;
+                case Kind::Pull:
+                    stackAddress(1);
+                    e.storeByte(Mem{ CPU_POINTER, layout.sp }, RAX);
+                    readDynamic();
+                    if (t.set) {
+                        e.moveImmediate64(RDX, reinterpret_cast<u64>(unpackTable().data()));
+                        e.loadByte(GUEST_P, Mem{ RDX, 0, RCX });
+                    } else {
+                        e.mov32(GUEST_A, RCX);
+                        setZeroNegative(GUEST_A);
+                    }
+                    break;
+                case Kind::Branch: {
+                    charge(cycles);
+                    e.test8(GUEST_P, t.flag);
+                    size_t taken = e.jumpIf(t.set ? NOT_EQUAL : EQUAL);
+                    Word target = static_cast<Word>(next + static_cast<SByte>(value));
+                    s32 penalty = 1 + (((next & 0xFF00) != (target & 0xFF00)) ? 1 : 0);
+                    exits.push_back(Exit{ { taken }, target, count, penalty, true, true });
+                    exits.push_back(Exit{ { e.jump() }, next, count, 0, false, true });
+                    return;
+                }
+                case Kind::Jump:
+                    charge(cycles);
+                    exits.push_back(Exit{ { e.jump() }, instruction.operand, count, 0, false, true });
+                    return;
+                case Kind::Call: {
+                    // pushToStack of the address of the operand's last byte, high byte first
+                    Word pushed = static_cast<Word>(instruction.pc + 2);
+                    stackAddress(0);
+                    writeDynamic(static_cast<Byte>(pushed >> 8));
+                    e.increment8(RAX, true);
+                    writeDynamic(static_cast<Byte>(pushed & 0xFF));
+                    e.increment8(RAX, true);
+                    e.storeByte(Mem{ CPU_POINTER, layout.sp }, RAX);
+                    charge(cycles);
+                    leaveCheck(instruction.operand, count);
+                    exits.push_back(Exit{ { e.jump() }, instruction.operand, count, 0, false, true });
+                    return;
+                }
+                case Kind::Return:
+                    // popFromStack reads a word at SP + 1 without wrapping inside page 1
+                    e.loadByte(RAX, Mem{ CPU_POINTER, layout.sp });
+                    e.alu32(ALU_ADD, RAX, 0x101);
+                    readDynamic();
+                    e.mov32(R8, RCX);
+                    e.alu32(ALU_ADD, RAX, 1);
+                    readDynamic();
+                    e.shift32(SHIFT_SHL, RCX, 8);
+                    e.alu32(ALU_OR, RCX, R8);
+                    e.alu32(ALU_ADD, RCX, 1);
+                    e.storeWord(Mem{ CPU_POINTER, layout.pc }, RCX);
+                    e.alu8(ALU_ADD, Mem{ CPU_POINTER, layout.sp }, Byte{ 2 });
+                    charge(cycles);
+                    if (slow) {
+                        e.alu8(ALU_CMP, Mem{ RSP, LEAVE_SLOT }, Byte{ 0 });
+                        exits.push_back(Exit{ { e.jumpIf(NOT_EQUAL) }, 0, count, 0, false, false, true });
+                    }
+                    exits.push_back(Exit{ { e.jump() }, 0, count, 0, false, true, true });
+                    return;
+            }
+
+            charge(cycles);
+            leaveCheck(next, count);
+        }
+
+        // JitExit block(CPU* cpu, Memory* memory, Byte* const* read_map, s32 budget)
+        void prologue() {
+            for (Reg reg : { RBX, RBP, R12, R13, R14, R15 }) {
+                e.push(reg);
+            }
+            e.adjustStack(-FRAME_SIZE);
+            e.mov64(CPU_POINTER, RDI);
+            e.store64(Mem{ RSP, MEMORY_SLOT }, RSI);
+            e.mov64(READ_MAP, RDX);
+            e.mov32(BUDGET, RCX);
+            e.store32(Mem{ RSP, ENTRY_BUDGET_SLOT }, RCX);
+            e.storeDword(Mem{ RSP, INSTRUCTIONS_SLOT }, 0);
+            e.storeByte(Mem{ RSP, LEAVE_SLOT }, Byte{ 0 });
+            loadGuest();
+        }
+
+        // Returns cycles run and instructions, edx holding the instructions of the block returning
+        void epilogue() {
+            storeGuest();
+            e.alu32(ALU_ADD, RDX, Mem{ RSP, INSTRUCTIONS_SLOT });
+            e.load32(RAX, Mem{ RSP, ENTRY_BUDGET_SLOT });
+            e.alu32(ALU_SUB, RAX, BUDGET);
+            e.shift64(SHIFT_SHL, RDX, 32);
+            e.alu64(ALU_OR, RAX, RDX);
+            e.adjustStack(FRAME_SIZE);
+            for (Reg reg : { R15, R14, R13, R12, RBP, RBX }) {
+                e.pop(reg);
+            }
+            e.ret();
+        }
+
+        void loadGuest() {
+            e.loadByte(GUEST_A, Mem{ CPU_POINTER, layout.a });
+            e.loadByte(GUEST_X, Mem{ CPU_POINTER, layout.x });
+            e.loadByte(GUEST_Y, Mem{ CPU_POINTER, layout.y });
+            e.loadByte(GUEST_P, Mem{ CPU_POINTER, layout.flags });
+            e.moveImmediate64(FLAG_TABLE, reinterpret_cast<u64>(zeroNegativeTable().data()));
+        }
+
+        void storeGuest() {
+            e.storeByte(Mem{ CPU_POINTER, layout.a }, GUEST_A);
+            e.storeByte(Mem{ CPU_POINTER, layout.x }, GUEST_X);
+            e.storeByte(Mem{ CPU_POINTER, layout.y }, GUEST_Y);
+            e.storeByte(Mem{ CPU_POINTER, layout.flags }, GUEST_P);
+        }
+
+        void emitExit(const Exit& exit) {
+            for (size_t jump : exit.jumps) {
+                e.bind(jump);
+            }
+            if (exit.penalty) {
+                charge(exit.penalty);
+            }
+            if (exit.branch_taken) {
+                e.incrementMemory64(Mem{ CPU_POINTER, layout.branches_taken });
+            }
+
+            u32 instructions = exit.instructions;
+            if (exit.chain) {
+                e.alu32(ALU_ADD, Mem{ RSP, INSTRUCTIONS_SLOT }, static_cast<s32>(instructions));
+                instructions = 0;
+                if (!exit.dynamic && exit.pc == start) {
+                    if (self_chain) {
+                        e.jumpTo(chain_start);
+                        return;
+                    }
+                } else {
+                    if (exit.dynamic) {
+                        e.loadWord(RAX, Mem{ CPU_POINTER, layout.pc });
+                        e.moveImmediate64(RCX, reinterpret_cast<u64>(entries));
+                        e.load64(RCX, Mem{ RCX, 0, RAX, 3 });
+                    } else {
+                        e.moveImmediate64(RCX, reinterpret_cast<u64>(&entries[exit.pc]));
+                        e.load64(RCX, Mem{ RCX });
+                    }
+                    e.test64(RCX);
+                    size_t untranslated = e.jumpIf(EQUAL);
+                    e.jumpRegister(RCX);
+                    e.bind(untranslated);
+                }
+            }
+            if (!exit.dynamic) {
+                e.storeWord(Mem{ CPU_POINTER, layout.pc }, exit.pc);
+            }
+            e.moveImmediate(RDX, instructions);
+            returns.push_back(e.jump());
+        }
+
+        void charge(s32 cycles) {
+            e.alu32(ALU_SUB, BUDGET, cycles);
+        }
+
+        // Leaves with the instruction finished if one of its slow paths asked to
+        void leaveCheck(Word next, u32 count) {
+            if (slow) {
+                e.alu8(ALU_CMP, Mem{ RSP, LEAVE_SLOT }, Byte{ 0 });
+                exits.push_back(Exit{ { e.jumpIf(NOT_EQUAL) }, next, count });
+            }
+        }
+
+        // Everything the handler might look at goes back into CPU first and is reloaded after
+        void interpret(const Instruction& instruction, u32 count) {
+            bool jumps = instruction.translation.kind == Kind::InterpretJump;
+            storeGuest();
+            e.store32(Mem{ CPU_POINTER, layout.clock_budget }, BUDGET);
+            e.mov64(RDI, CPU_POINTER);
+            e.load64(RSI, Mem{ RSP, MEMORY_SLOT });
+            e.moveImmediate64(RDX, reinterpret_cast<u64>(dispatch_table[instruction.opcode]));
+            e.moveImmediate(RCX, instruction.pc);
+            e.moveImmediate(R8, jumps ? ADDRESS_SPACE : static_cast<Word>(instruction.pc + instruction.length));
+            e.call(reinterpret_cast<const void*>(&jitInterpret));
+            loadGuest();
+            e.alu32(ALU_SUB, BUDGET, RAX);
+            e.shift64(SHIFT_SHR, RAX, 32);
+            exits.push_back(Exit{ { e.jumpIf(NOT_EQUAL) }, 0, count, 0, false, false, true });
+            if (jumps) {
+                exits.push_back(Exit{ { e.jump() }, 0, count, 0, false, true, true });
+            }
+        }
+
+        // eax = operand + X or Y, wrapped to a Word
+        void absoluteIndexed(Word operand, AddressingMode mode) {
+            e.lea32(RAX, Mem{ mode == AddressingMode::AbsoluteX ? GUEST_X : GUEST_Y, operand });
+            e.zeroExtendWord(RAX, RAX);
+        }
+
+        // r8d = 1 when eax is on another page than the operand. Charged after the access, which sees
+        // the clock as of the start of the instruction
+        void pageCrossing(Word operand) {
+            e.mov32(R8, RAX);
+            e.shift32(SHIFT_SHR, R8, 8);
+            e.alu32(ALU_CMP, R8, operand >> 8);
+            e.setCondition(NOT_EQUAL, R8);
+            e.zeroExtendByte(R8, R8);
+        }
+
+        void chargePageCrossing() {
+            e.alu32(ALU_SUB, BUDGET, R8);
+            e.alu64(ALU_ADD, Mem{ CPU_POINTER, layout.page_crossings }, R8);
+        }
+
+        // dst = a guest register, or SP for NO_REG
+        void registerValue(Reg dst, Reg reg) {
+            if (reg == NO_REG) {
+                e.loadByte(dst, Mem{ CPU_POINTER, layout.sp });
+            } else {
+                e.mov32(dst, reg);
+            }
+        }
+
+        // eax = 0x100 | SP, after moving SP on by 'pull' first
+        void stackAddress(Byte pull) {
+            e.loadByte(RAX, Mem{ CPU_POINTER, layout.sp });
+            if (pull) {
+                e.increment8(RAX, false);
+            }
+            e.alu32(ALU_OR, RAX, 0x100);
+        }
+
+        // ecx = byte at a fixed address, through read_map or the slow path
+        void readStatic(Word address) {
+            e.load64(RDX, Mem{ READ_MAP, (address >> 8) * 8 });
+            e.test64(RDX);
+            size_t missing = e.jumpIf(EQUAL);
+            e.loadByte(RCX, Mem{ RDX, address & 0xFF });
+            slowRead(missing, e.size(), address);
+        }
+
+        // ecx = byte at eax
+        void readDynamic() {
+            pageEntry(0);
+            size_t missing = e.jumpIf(EQUAL);
+            e.zeroExtendByte(RSI, RAX);
+            e.loadByte(RCX, Mem{ RDX, 0, RSI });
+            slowRead(missing, e.size(), -1);
+        }
+
+        void writeStatic(Word address, Reg reg) {
+            e.load64(RDX, Mem{ READ_MAP, write_map_offset + (address >> 8) * 8 });
+            e.test64(RDX);
+            size_t missing = e.jumpIf(EQUAL);
+            e.storeByte(Mem{ RDX, address & 0xFF }, reg);
+            slowWrite(missing, e.size(), address, reg, 0);
+        }
+
+        // Writes to eax
+        void writeDynamic(Reg reg) {
+            pageEntry(write_map_offset);
+            size_t missing = e.jumpIf(EQUAL);
+            e.zeroExtendByte(RSI, RAX);
+            e.storeByte(Mem{ RDX, 0, RSI }, reg);
+            slowWrite(missing, e.size(), -1, reg, 0);
+        }
+
+        void writeDynamic(Byte value) {
+            pageEntry(write_map_offset);
+            size_t missing = e.jumpIf(EQUAL);
+            e.zeroExtendByte(RSI, RAX);
+            e.storeByte(Mem{ RDX, 0, RSI }, value);
+            slowWrite(missing, e.size(), -1, NO_REG, value);
+        }
+
+        // rdx = the map entry for eax's page, tested for null
+        void pageEntry(s32 map_offset) {
+            e.mov32(RDX, RAX);
+            e.shift32(SHIFT_SHR, RDX, 8);
+            e.load64(RDX, Mem{ READ_MAP, map_offset, RDX, 3 });
+            e.test64(RDX);
+        }
+
+        // A slow path is a call out of the block at 'missing', returning to 'resume'. The address is
+        // 'address', or eax for -1. eax and r8d come back unchanged
+        void slowRead(size_t missing, size_t resume, s32 address) {
+            slow = true;
+            slow_paths.emplace_back([this, missing, resume, address] {
+                e.bind(missing);
+                beginCall(address);
+                e.call(reinterpret_cast<const void*>(&jitRead));
+                endCall();
+                e.mov32(RCX, RAX);
+                e.shift32(SHIFT_SHR, RAX, 8);
+                e.alu8(ALU_OR, Mem{ RSP, LEAVE_SLOT }, RAX);
+                e.zeroExtendByte(RCX, RCX);
+                restoreTemporaries();
+                e.jumpTo(resume);
+            });
+        }
+
+        void slowWrite(size_t missing, size_t resume, s32 address, Reg reg, Byte value) {
+            slow = true;
+            slow_paths.emplace_back([this, missing, resume, address, reg, value] {
+                e.bind(missing);
+                beginCall(address);
+                if (reg == NO_REG) {
+                    e.moveImmediate(RCX, value);
+                } else if (reg != RCX) {
+                    e.mov32(RCX, reg);
+                }
+                e.call(reinterpret_cast<const void*>(&jitWrite));
+                endCall();
+                e.alu8(ALU_OR, Mem{ RSP, LEAVE_SLOT }, RAX);
+                restoreTemporaries();
+                e.jumpTo(resume);
+            });
+        }
+
+        // rdi, rsi and edx set up for jitRead / jitWrite, with P and the clock where devices see them
+        void beginCall(s32 address) {
+            e.store32(Mem{ RSP, SAVED_RAX_SLOT }, RAX);
+            e.store32(Mem{ RSP, SAVED_R8_SLOT }, R8);
+            e.storeByte(Mem{ CPU_POINTER, layout.flags }, GUEST_P);
+            e.store32(Mem{ CPU_POINTER, layout.clock_budget }, BUDGET);
+            e.mov64(RDI, CPU_POINTER);
+            e.load64(RSI, Mem{ RSP, MEMORY_SLOT });
+            if (address < 0) {
+                e.mov32(RDX, RAX);
+            } else {
+                e.moveImmediate(RDX, static_cast<u32>(address));
+            }
+        }
+
+        void endCall() {
+            e.loadByte(GUEST_P, Mem{ CPU_POINTER, layout.flags });
+            e.moveImmediate64(FLAG_TABLE, reinterpret_cast<u64>(zeroNegativeTable().data()));
+        }
+
+        void restoreTemporaries() {
+            e.load32(RAX, Mem{ RSP, SAVED_RAX_SLOT });
+            e.load32(R8, Mem{ RSP, SAVED_R8_SLOT });
+        }
+
+        void clearFlags(Byte mask) {
+            e.alu32(ALU_AND, GUEST_P, ~static_cast<s32>(mask));
+        }
+
+        // Z and N from the register, as setRegisterFlag does
+        void setZeroNegative(Reg reg) {
+            clearFlags(f.Z | f.N);
+            e.alu8(ALU_OR, GUEST_P, Mem{ FLAG_TABLE, 0, reg });
+        }
+
+        // Z and N for a value known while translating
+        void setZeroNegative(Byte value) {
+            clearFlags(f.Z | f.N);
+            Byte bits = zeroNegativeTable()[value];
+            if (bits) {
+                e.alu32(ALU_OR, GUEST_P, bits);
+            }
+        }
+
+        // ADC as the handler does it: the sum is kept in a Byte, so C always ends up clear. SBC adds
+        // the operand's complement
+        void add(bool immediate, Byte value, Word address, bool subtract) {
+            if (!immediate) {
+                readStatic(address);
+                if (subtract) {
+                    e.not8(RCX);
+                }
+            }
+            e.bitTest32(GUEST_P, shiftOf(f.C));
+            if (immediate) {
+                e.alu8(ALU_ADC, GUEST_A, static_cast<Byte>(subtract ? ~value : value));
+            } else {
+                e.alu8(ALU_ADC, GUEST_A, RCX);
+            }
+            e.setCondition(OVERFLOW, RAX);
+            clearFlags(f.C | f.Z | f.V | f.N);
+            e.shift8(SHIFT_SHL, RAX, shiftOf(f.V));
+            e.alu8(ALU_OR, GUEST_P, RAX);
+            e.alu8(ALU_OR, GUEST_P, Mem{ FLAG_TABLE, 0, GUEST_A });
+        }
+
+        // C, Z and N as setComparisonFlags does
+        void compare(Reg reg, bool immediate, Byte value, Word address) {
+            if (!immediate) {
+                readStatic(address);
+            }
+            e.mov32(RAX, reg);
+            if (immediate) {
+                e.alu8(ALU_SUB, RAX, value);
+            } else {
+                e.alu8(ALU_SUB, RAX, RCX);
+            }
+            e.setCondition(NOT_CARRY, RDX);
+            clearFlags(f.C | f.Z | f.N);
+            e.shift8(SHIFT_SHL, RDX, shiftOf(f.C));
+            e.alu8(ALU_OR, GUEST_P, RDX);
+            e.alu8(ALU_OR, GUEST_P, Mem{ FLAG_TABLE, 0, RAX });
+        }
+
+        // Z from A and the operand, N and V from A, as the handler does it
+        void bitTest(Word address) {
+            readStatic(address);
+            clearFlags(f.Z | f.V | f.N);
+            e.test8(RCX, GUEST_A);
+            e.setCondition(EQUAL, RAX);
+            e.shift8(SHIFT_SHL, RAX, shiftOf(f.Z));
+            e.alu8(ALU_OR, GUEST_P, RAX);
+            e.test8(GUEST_A, 0x80);
+            e.setCondition(NOT_EQUAL, RAX);
+            e.shift8(SHIFT_SHL, RAX, shiftOf(f.N));
+            e.alu8(ALU_OR, GUEST_P, RAX);
+            e.test8(GUEST_A, 0x40);
+            e.setCondition(NOT_EQUAL, RAX);
+            e.shift8(SHIFT_SHL, RAX, shiftOf(f.V));
+            e.alu8(ALU_OR, GUEST_P, RAX);
+        }
+
+        // C, Z and N from shifting the register, which holds zero extended bytes. ROR takes its carry
+        // from bit 7, as the handler does
+        void shift(ShiftKind kind, Reg reg) {
+            switch (kind) {
+                case ShiftKind::ASL:
+                    e.shift8(SHIFT_SHL, reg);
+                    e.setCondition(CARRY, RAX);
+                    break;
+                case ShiftKind::LSR:
+                    e.shift8(SHIFT_SHR, reg);
+                    e.setCondition(CARRY, RAX);
+                    break;
+                case ShiftKind::ROL:
+                    e.bitTest32(GUEST_P, shiftOf(f.C));
+                    e.shift8(SHIFT_RCL, reg);
+                    e.setCondition(CARRY, RAX);
+                    break;
+                case ShiftKind::ROR:
+                    e.mov32(RAX, reg);
+                    e.shift32(SHIFT_SHR, RAX, 7);
+                    e.bitTest32(GUEST_P, shiftOf(f.C));
+                    e.shift8(SHIFT_RCR, reg);
+                    break;
+            }
+            clearFlags(f.C | f.Z | f.N);
+            e.shift8(SHIFT_SHL, RAX, shiftOf(f.C));
+            e.alu8(ALU_OR, GUEST_P, RAX);
+            e.alu8(ALU_OR, GUEST_P, Mem{ FLAG_TABLE, 0, reg });
+        }
+    };
+
+#endif
+
+}
+
+JitCache::JitCache() : entries(std::make_unique<Byte*[]>(ADDRESS_SPACE)) {
+#if EMULATOR_6502_JIT
+    void* arena = mmap(nullptr, ARENA_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (arena != MAP_FAILED) {
+        code = static_cast<Byte*>(arena);
+        code_size = ARENA_SIZE;
+    }
+#endif
+}
+
+JitCache::~JitCache() {
+#if EMULATOR_6502_JIT
+    if (code) {
+        munmap(code, code_size);
+    }
+#endif
+}
+
+// Scans the block at pc, emits it and registers it on every page it covers
+const JitBlock& JitCache::translate(Word pc, Bus& bus) {
+    auto block = std::make_unique<JitBlock>();
+    block->start = pc;
+
+#if EMULATOR_6502_JIT
+    const HandlerTiming& timing = handlerTiming();
+    std::vector<Instruction> instructions;
+    // Every instruction but a closing branch or JMP could be part of an idle loop
+    bool idle = true;
+    u32 address = pc;
+    while (code && instructions.size() < MAX_BLOCK_INSTRUCTIONS) {
+        // Every byte must be plain memory that reads without side effects
+        if (address >= ADDRESS_SPACE || !bus.readPage(static_cast<Word>(address))) {
+            break;
+        }
+        // An invalid opcode is left to the interpreter, which throws for it
+        Byte opcode = bus.peek(static_cast<Word>(address));
+        if (!dispatch_table[opcode]) {
+            break;
+        }
+        Translation translation = translationFor(opcode);
+        bool ends = endsBlock(translation.kind);
+        Byte length = ends ? 1 + operandBytes(opcode_table[opcode].mode) : timing.length[opcode];
+        if (address + length > ADDRESS_SPACE || !bus.readPage(static_cast<Word>(address + length - 1))) {
+            break;
+        }
+
+        Word operand = 0;
+        if (length > 1) {
+            operand = bus.peek(static_cast<Word>(address + 1));
+        }
+        if (length > 2) {
+            operand |= bus.peek(static_cast<Word>(address + 2)) << 8;
+        }
+        instructions.push_back(Instruction{ static_cast<Word>(address), opcode, operand, length, translation });
+        address += length;
+
+        if (ends) {
+            idle = idle && (translation.kind == Kind::Branch || translation.kind == Kind::Jump);
+            break;
+        }
+        idle = idle && idle_loop_table[opcode];
+    }
+
+    if (!instructions.empty()) {
+        for (size_t i = 0; i + 1 < instructions.size(); i++) {
+            block->guard += timing.worst[instructions[i].opcode];
+        }
+
+        size_t chain_entry = 0;
+        std::vector<Byte> bytes = BlockEmitter(pc, entries.get(), writeMapOffset(bus))
+            .emit(instructions, static_cast<Word>(address), block->guard, idle, chain_entry);
+        Byte* placed = place(bytes);
+        if (!placed) {
+            // A flush forgot every block, including the ones that pointed here
+            flush();
+            placed = place(bytes);
+        }
+        if (placed) {
+            block->code = reinterpret_cast<JitCode>(placed);
+            block->length = address - pc;
+            block->instructions = static_cast<u32>(instructions.size());
+            entries[pc] = placed + chain_entry;
+            translation_count++;
+        } else {
+            block->guard = 0;
+        }
+    }
+#endif
+
+    // Untranslatable starts are remembered too, so the interpreter does not ask again every time
+    u32 last = pc + std::max<u32>(block->length, 1) - 1;
+    for (u32 page = pc >> 8; page <= (last >> 8) && page < Bus::PAGE_COUNT; page++) {
+        page_blocks[page].push_back(pc);
+        bus.markCode(page);
+    }
+
+    std::unique_ptr<Table>& table = tables[pc >> 8];
+    if (!table) {
+        table = std::make_unique<Table>();
+    }
+    table->blocks[pc & 0xFF] = block.get();
+    blocks.push_back(std::move(block));
+    return *blocks.back();
+}
+
+// Copies code into the arena, nullptr when it is full or its pages could not be switched between
+// writable and executable. Only the pages being written are switched, blocks on the others keep running
+Byte* JitCache::place(const std::vector<Byte>& bytes) {
+#if EMULATOR_6502_JIT
+    if (!code || code_used + bytes.size() > code_size) {
+        return nullptr;
+    }
+
+    const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    Byte* target = code + code_used;
+    Byte* first = code + code_used / page_size * page_size;
+    size_t span = (code_used + bytes.size() + page_size - 1) / page_size * page_size - (first - code);
+    if (mprotect(first, span, PROT_READ | PROT_WRITE) != 0) {
+        return nullptr;
+    }
+    std::memcpy(target, bytes.data(), bytes.size());
+    if (mprotect(first, span, PROT_READ | PROT_EXEC) != 0) {
+        return nullptr;
+    }
+    code_used += (bytes.size() + 15) & ~size_t{15};
+    return target;
+#else
+    (void)bytes;
+    return nullptr;
+#endif
+}
+
+void JitCache::invalidatePage(u32 index) {
+    for (Word start : page_blocks[index]) {
+        if (tables[start >> 8]) {
+            tables[start >> 8]->blocks[start & 0xFF] = nullptr;
+        }
+        entries[start] = nullptr;
+    }
+    page_blocks[index].clear();
+    invalidation_count++;
+}
+
+void JitCache::clear() {
+    for (std::unique_ptr<Table>& table : tables) {
+        table.reset();
+    }
+    for (std::vector<Word>& starts : page_blocks) {
+        starts.clear();
+    }
+    std::fill_n(entries.get(), ADDRESS_SPACE, nullptr);
+}
+
+// Only called between blocks, never from inside one
+void JitCache::flush() {
+    clear();
+    blocks.clear();
+    code_used = 0;
+    flush_count++;
+}
+
+
+// Verification
+JitVerifier::JitVerifier(const CPU& cpu, const Memory& memory)
+    : shadow_cpu(cpu), shadow_memory(std::make_unique<Memory>(memory)),
+      expected(std::make_unique<Byte[]>(Memory::MAX_MEMORY)), actual(std::make_unique<Byte[]>(Memory::MAX_MEMORY)) {}
+
+JitVerifier::~JitVerifier() = default;
+
+void JitVerifier::check(const CPU& cpu, const Memory& memory, u32 instructions, s32 cycles, Word block_start) {
+    s32 shadow_cycles = 0;
+    for (u32 i = 0; i < instructions; i++) {
+        shadow_cycles += shadow_cpu.step(*shadow_memory);
+    }
+
+    char line[160];
+    std::string differences;
+    auto compare = [&](const char* name, u64 got, u64 want) {
+        if (got != want) {
+            std::snprintf(line, sizeof(line), " %s %llX (interpreter %llX)", name,
+                          static_cast<unsigned long long>(got), static_cast<unsigned long long>(want));
+            differences += line;
+        }
+    };
+    compare("PC", cpu.PC, shadow_cpu.PC);
+    compare("A", cpu.Accumulator, shadow_cpu.Accumulator);
+    compare("X", cpu.X_reg, shadow_cpu.X_reg);
+    compare("Y", cpu.Y_reg, shadow_cpu.Y_reg);
+    compare("SP", cpu.SP, shadow_cpu.SP);
+    compare("P", CPU::packStatusFlags(cpu.flags), CPU::packStatusFlags(shadow_cpu.flags));
+    compare("cycles", static_cast<u32>(cycles), static_cast<u32>(shadow_cycles));
+    compare("branches_taken", cpu.branches_taken, shadow_cpu.branches_taken);
+    compare("page_crossings", cpu.page_crossings, shadow_cpu.page_crossings);
+
+    memory.copyOut(actual.get());
+    shadow_memory->copyOut(expected.get());
+    if (std::memcmp(actual.get(), expected.get(), Memory::MAX_MEMORY) != 0) {
+        for (u32 address = 0; address < Memory::MAX_MEMORY; address++) {
+            if (actual[address] != expected[address]) {
+                std::snprintf(line, sizeof(line), " memory $%04X %02X (interpreter %02X)", address,
+                              actual[address], expected[address]);
+                differences += line;
+                break;
+            }
+        }
+    }
+
+    if (!differences.empty()) {
+        std::snprintf(line, sizeof(line), "JIT block at $%04X (%u instructions) differs:", block_start, instructions);
+        throw JitMismatchException(line + differences);
+    }
+}
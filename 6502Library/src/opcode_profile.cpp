@@ -0,0 +1,92 @@
+//
+// Per opcode execution and cycle counts
+//
+
+#include "../include/opcode_profile.h"
+
+#include <algorithm>
+#include <numeric>
+
+using namespace emulator_6502;
+
+void OpcodeProfile::reset() {
+    *this = OpcodeProfile{};
+}
+
+u64 OpcodeProfile::totalExecutions() const {
+    return std::accumulate(executions.begin(), executions.end(), u64{0});
+}
+
+u64 OpcodeProfile::totalCycles() const {
+    return std::accumulate(cycles.begin(), cycles.end(), u64{0});
+}
+
+std::vector<OpcodeProfile::Pair> OpcodeProfile::hottestPairs(size_t count) const {
+    std::vector<Pair> hottest;
+    for (u32 index = 0; index < pairs.size(); index++) {
+        if (pairs[index] != 0) {
+            hottest.push_back({static_cast<Byte>(index >> 8), static_cast<Byte>(index & 0xFF), pairs[index]});
+        }
+    }
+
+    std::sort(hottest.begin(), hottest.end(), [](const Pair& a, const Pair& b) {
+        return a.executions > b.executions;
+    });
+    if (hottest.size() > count) {
+        hottest.resize(count);
+    }
+    return hottest;
+}
+
+// opcode,mnemonic,mode,executions,cycles,page_crosses,branches_taken,branches_not_taken
+void OpcodeProfile::writeCsv(std::ostream& out) const {
+    out << "opcode,mnemonic,mode,executions,cycles,page_crosses,branches_taken,branches_not_taken\n";
+    for (u32 opcode = 0; opcode < 256; opcode++) {
+        if (executions[opcode] == 0) {
+            continue;
+        }
+
+        const OpcodeInfo& info = opcode_table[opcode];
+        char code[8];
+        std::snprintf(code, sizeof(code), "0x%02X", opcode);
+        out << code << ',' << info.mnemonic << ',' << addressingModeName(info.mode) << ','
+            << executions[opcode] << ',' << cycles[opcode] << ',' << page_crosses[opcode] << ','
+            << branches_taken[opcode] << ',' << branches_not_taken[opcode] << '\n';
+    }
+}
+
+// {"total_executions": n, "total_cycles": n, "opcodes": [{...}, ...]}
+void OpcodeProfile::writeJson(std::ostream& out) const {
+    out << "{\n  \"total_executions\": " << totalExecutions() << ",\n  \"total_cycles\": " << totalCycles()
+        << ",\n  \"opcodes\": [";
+
+    bool first = true;
+    for (u32 opcode = 0; opcode < 256; opcode++) {
+        if (executions[opcode] == 0) {
+            continue;
+        }
+
+        const OpcodeInfo& info = opcode_table[opcode];
+        char code[8];
+        std::snprintf(code, sizeof(code), "0x%02X", opcode);
+        out << (first ? "\n" : ",\n")
+            << "    {\"opcode\": \"" << code << "\", \"mnemonic\": \"" << info.mnemonic
+            << "\", \"mode\": \"" << addressingModeName(info.mode) << "\", \"executions\": " << executions[opcode]
+            << ", \"cycles\": " << cycles[opcode] << ", \"page_crosses\": " << page_crosses[opcode]
+            << ", \"branches_taken\": " << branches_taken[opcode]
+            << ", \"branches_not_taken\": " << branches_not_taken[opcode] << "}";
+        first = false;
+    }
+
+    out << "\n  ],\n  \"hot_pairs\": [";
+    first = true;
+    for (const Pair& pair : hottestPairs(16)) {
+        out << (first ? "\n" : ",\n")
+            << "    {\"first\": \"" << opcode_table[pair.first].mnemonic << ' '
+            << addressingModeName(opcode_table[pair.first].mode) << "\", \"second\": \""
+            << opcode_table[pair.second].mnemonic << ' ' << addressingModeName(opcode_table[pair.second].mode)
+            << "\", \"executions\": " << pair.executions << "}";
+        first = false;
+    }
+    out << "\n  ]\n}\n";
+}
@@ -0,0 +1,83 @@
+//
+// Runs a CPU at a fixed clock rate against the host's wall clock
+//
+
+#include "../include/realtime.h"
+
+#include <cmath>
+#include <stdexcept>
+#include <thread>
+
+using namespace emulator_6502;
+
+RealtimeStats emulator_6502::runRealtime(CPU& cpu, Memory& memory, double hz, const RealtimeOptions& options) {
+    using Clock = std::chrono::steady_clock;
+    using Micros = std::chrono::duration<double, std::micro>;
+    using Seconds = std::chrono::duration<double>;
+
+    if (!(hz > 0) || !std::isfinite(hz)) {
+        throw std::invalid_argument("runRealtime needs a clock rate above 0 Hz");
+    }
+
+    RealtimeStats stats;
+    const Clock::duration batch = std::max<Clock::duration>(options.batch, std::chrono::microseconds(1));
+    const double batch_cycles = hz * Seconds(batch).count();
+
+    const Clock::time_point start = Clock::now();
+    Clock::time_point origin = start;       // Where the schedule counts from, moved on by a resync
+    u64 origin_cycles = 0;                  // stats.cycles at origin
+    u64 batch_index = 0;                    // Batches since origin
+    Clock::time_point wake = start;
+    Clock::time_point finished = start;
+    double jitter_sum = 0.0;
+    double jitter_squares = 0.0;
+
+    while (true) {
+        Clock::time_point due = origin + batch * static_cast<Clock::rep>(batch_index);
+        double late = std::max(0.0, Micros(wake - due).count());
+        jitter_sum += late;
+        jitter_squares += late * late;
+        stats.jitter_max_us = std::max(stats.jitter_max_us, late);
+
+        if (wake - due > options.max_lag) {
+            origin = wake;
+            origin_cycles = stats.cycles;
+            batch_index = 0;
+            stats.resyncs++;
+        }
+
+        // Everything up to the start of the next batch, less what earlier batches overshot by
+        u64 target = origin_cycles + static_cast<u64>(std::llround(batch_cycles * static_cast<double>(batch_index + 1)));
+        if (options.cycles) {
+            target = std::min(target, options.cycles);
+        }
+        if (target > stats.cycles) {
+            u64 budget = std::min<u64>(target - stats.cycles, std::numeric_limits<s32>::max());
+            u64 before = cpu.cycle();
+            cpu.execute(static_cast<s32>(budget), memory);
+            stats.cycles += cpu.cycle() - before;
+        }
+        stats.batches++;
+
+        bool stop = options.after_batch && options.after_batch(cpu, memory);
+        finished = Clock::now();
+        stats.busy_seconds += Seconds(finished - wake).count();
+
+        if (stop || (options.cycles && stats.cycles >= options.cycles) ||
+            (options.stop && options.stop->load(std::memory_order_relaxed))) {
+            break;
+        }
+
+        batch_index++;
+        std::this_thread::sleep_until(origin + batch * static_cast<Clock::rep>(batch_index));
+        wake = Clock::now();
+    }
+
+    // The last batch ran the cycles for the whole of its slot, so the run lasts until that slot ends
+    Clock::time_point end = std::max(finished, origin + batch * static_cast<Clock::rep>(batch_index + 1));
+    stats.seconds = Seconds(end - start).count();
+    double mean = jitter_sum / stats.batches;
+    stats.jitter_mean_us = mean;
+    stats.jitter_stddev_us = std::sqrt(std::max(0.0, jitter_squares / stats.batches - mean * mean));
+    return stats;
+}
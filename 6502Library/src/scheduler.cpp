@@ -0,0 +1,58 @@
+//
+// Events posted at future cycles, run by execute between instructions
+//
+
+#include "../include/scheduler.h"
+
+#include <algorithm>
+
+using namespace emulator_6502;
+
+Scheduler::EventId Scheduler::schedule(u64 cycle, Callback callback) {
+    EventId id = next_id++;
+    events.push_back({cycle, id, std::move(callback)});
+    std::push_heap(events.begin(), events.end(), Later{});
+    return id;
+}
+
+bool Scheduler::cancel(EventId id) {
+    bool queued = std::any_of(events.begin(), events.end(), [id](const Event& event) {
+        return event.id == id;
+    });
+    if (!queued || !cancelled.insert(id).second) {
+        return false;
+    }
+    dropCancelled();
+    return true;
+}
+
+void Scheduler::clear() {
+    events.clear();
+    cancelled.clear();
+}
+
+void Scheduler::runUntil(u64 cycle) {
+    while (!events.empty() && events.front().cycle <= cycle) {
+        std::pop_heap(events.begin(), events.end(), Later{});
+        Event event = std::move(events.back());
+        events.pop_back();
+
+        now_cycle = std::max(now_cycle, event.cycle);
+        event.callback(event.cycle);
+        dropCancelled();
+    }
+    advanceTo(cycle);
+}
+
+void Scheduler::advanceTo(u64 cycle) {
+    now_cycle = std::max(now_cycle, cycle);
+}
+
+// Keeps a live event at the front so nextDeadline() never reports a cancelled one
+void Scheduler::dropCancelled() {
+    while (!events.empty() && !cancelled.empty() && cancelled.count(events.front().id)) {
+        cancelled.erase(events.front().id);
+        std::pop_heap(events.begin(), events.end(), Later{});
+        events.pop_back();
+    }
+}
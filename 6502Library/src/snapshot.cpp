@@ -0,0 +1,109 @@
+//
+// Saving and restoring the full machine state as a compact binary blob
+//
+
+#include "../include/snapshot.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace emulator_6502;
+
+namespace {
+
+    constexpr char snapshot_magic[4] = { '6', '5', 'S', 'N' };
+
+    void putWord(Byte* out, Word value) {
+        out[0] = value & 0xFF;
+        out[1] = value >> 8;
+    }
+
+    Word getWord(const Byte* in) {
+        return in[0] | (in[1] << 8);
+    }
+
+    void putLong(Byte* out, u32 value) {
+        for (int i = 0; i < 4; i++) {
+            out[i] = (value >> (8 * i)) & 0xFF;
+        }
+    }
+
+    u32 getLong(const Byte* in) {
+        return in[0] | (in[1] << 8) | (in[2] << 16) | (static_cast<u32>(in[3]) << 24);
+    }
+
+    void putQuad(Byte* out, u64 value) {
+        putLong(out, static_cast<u32>(value));
+        putLong(out + 4, static_cast<u32>(value >> 32));
+    }
+
+    u64 getQuad(const Byte* in) {
+        return getLong(in) | (static_cast<u64>(getLong(in + 4)) << 32);
+    }
+
+}
+
+// Writes the state into a caller provided buffer without allocating
+size_t emulator_6502::saveState(const CPU& cpu, const Memory& memory, Byte* buffer, size_t size) {
+    if (size < SNAPSHOT_SIZE) {
+        return 0;
+    }
+
+    std::memcpy(buffer, snapshot_magic, sizeof(snapshot_magic));
+    putWord(buffer + 4, SNAPSHOT_VERSION);
+    putWord(buffer + 6, SNAPSHOT_HEADER_SIZE);
+    putWord(buffer + 8, cpu.PC);
+    buffer[10] = cpu.SP;
+    buffer[11] = cpu.Accumulator;
+    buffer[12] = cpu.X_reg;
+    buffer[13] = cpu.Y_reg;
+    buffer[14] = CPU::packStatusFlags(cpu.flags);
+    buffer[15] = cpu.nmi_pending ? 0x01 : 0x00;
+    putQuad(buffer + 16, cpu.cycle());
+    putQuad(buffer + 24, cpu.carried_cycles);
+    putLong(buffer + 32, cpu.irq_sources);
+
+    memory.copyOut(buffer + SNAPSHOT_HEADER_SIZE);
+    return SNAPSHOT_SIZE;
+}
+
+// Writes the state into a new buffer
+std::vector<Byte> emulator_6502::saveState(const CPU& cpu, const Memory& memory) {
+    std::vector<Byte> buffer(SNAPSHOT_SIZE);
+    saveState(cpu, memory, buffer.data(), buffer.size());
+    return buffer;
+}
+
+// Restores a state written by saveState
+bool emulator_6502::loadState(CPU& cpu, Memory& memory, const Byte* buffer, size_t size) {
+    if (size < SNAPSHOT_HEADER_SIZE || std::memcmp(buffer, snapshot_magic, sizeof(snapshot_magic)) != 0) {
+        return false;
+    }
+
+    Word version = getWord(buffer + 4);
+    Word header_size = getWord(buffer + 6);
+    if (version != SNAPSHOT_VERSION || header_size < SNAPSHOT_HEADER_SIZE || size < header_size + Memory::MAX_MEMORY) {
+        return false;
+    }
+
+    cpu.PC = getWord(buffer + 8);
+    cpu.SP = buffer[10];
+    cpu.Accumulator = buffer[11];
+    cpu.X_reg = buffer[12];
+    cpu.Y_reg = buffer[13];
+    cpu.flags = CPU::unpackStatusFlags(buffer[14]);
+    // Between execute calls the clock is all in slice_start
+    cpu.slice_start = getQuad(buffer + 16);
+    cpu.slice_budget = 0;
+    cpu.clock_budget = 0;
+    cpu.carried_cycles = getQuad(buffer + 24);
+    cpu.irq_sources = getLong(buffer + 32);
+    cpu.nmi_pending = buffer[15] & 0x01;
+
+    memory.copyIn(buffer + header_size);
+    return true;
+}
+
+bool emulator_6502::loadState(CPU& cpu, Memory& memory, const std::vector<Byte>& buffer) {
+    return loadState(cpu, memory, buffer.data(), buffer.size());
+}
@@ -0,0 +1,266 @@
+//
+// MOS 6522 Versatile Interface Adapter: two 8-bit ports and two 16-bit timers
+//
+
+#include "../include/via_6522.h"
+
+using namespace emulator_6502;
+
+Via6522::Via6522(CPU& cpu, Scheduler& scheduler, u32 irq_source)
+    : ClockedDevice(cpu, scheduler), irq_source(irq_source) {}
+
+Via6522::~Via6522() {
+    cancel(t1_event);
+    cancel(t2_event);
+    cpu.setIRQ(irq_source, false);
+}
+
+Byte Via6522::readRegister(Word address) {
+    switch (address & 0x0F) {
+        case ORB:
+            clearFlags(irq_cb1 | irq_cb2);
+            return portB();
+        case ORA:
+            clearFlags(irq_ca1 | irq_ca2);
+            return portA();
+        case ORA_NO_HANDSHAKE:
+            return portA();
+        case DDRB:
+            return ddrb;
+        case DDRA:
+            return ddra;
+        case T1C_L:
+            clearFlags(irq_timer1);
+            return timer1() & 0xFF;
+        case T1C_H:
+            return timer1() >> 8;
+        case T1L_L:
+            return t1_latch & 0xFF;
+        case T1L_H:
+            return t1_latch >> 8;
+        case T2C_L:
+            clearFlags(irq_timer2);
+            return timer2() & 0xFF;
+        case T2C_H:
+            return timer2() >> 8;
+        case SR:
+            clearFlags(irq_sr);
+            return sr;
+        case ACR:
+            return acr;
+        case PCR:
+            return pcr;
+        case IFR:
+            return ifr | ((ifr & ier) ? irq_any : 0);
+        default:    // IER
+            return ier | irq_any;
+    }
+}
+
+void Via6522::writeRegister(Word address, Byte value) {
+    u64 now = cpu.cycle();
+    Byte old_a = portA();
+    Byte old_b = portB();
+
+    switch (address & 0x0F) {
+        case ORB:
+            orb = value;
+            clearFlags(irq_cb1 | irq_cb2);
+            break;
+        case ORA:
+            ora = value;
+            clearFlags(irq_ca1 | irq_ca2);
+            break;
+        case ORA_NO_HANDSHAKE:
+            ora = value;
+            break;
+        case DDRB:
+            ddrb = value;
+            break;
+        case DDRA:
+            ddra = value;
+            break;
+        case T1C_L:
+        case T1L_L:
+            t1_latch = (t1_latch & 0xFF00) | value;
+            break;
+        case T1C_H:
+            // Loads the counter from the latch, the time-out comes N + 1 cycles later
+            t1_latch = (t1_latch & 0x00FF) | (value << 8);
+            t1_counter = t1_latch;
+            t1_started = true;
+            t1_armed = true;
+            if (acr & 0x80) {
+                pb7 = false;
+            }
+            clearFlags(irq_timer1);
+            scheduleTimer1(now);
+            break;
+        case T1L_H:
+            t1_latch = (t1_latch & 0x00FF) | (value << 8);
+            clearFlags(irq_timer1);
+            break;
+        case T2C_L:
+            t2_latch_low = value;
+            break;
+        case T2C_H:
+            t2_counter = t2_latch_low | (value << 8);
+            t2_armed = true;
+            clearFlags(irq_timer2);
+            scheduleTimer2(now);
+            break;
+        case SR:
+            sr = value;
+            clearFlags(irq_sr);
+            break;
+        case ACR:
+            acr = value;
+            if (!continuous() && t1_counter < 0) {
+                t1_counter = 0xFFFF;
+            }
+            scheduleTimer1(now);
+            scheduleTimer2(now);
+            break;
+        case PCR:
+            pcr = value;
+            break;
+        case IFR:
+            clearFlags(value & 0x7F);
+            break;
+        default:    // IER, bit 7 says whether the other bits set or clear
+            if (value & irq_any) {
+                ier |= value & 0x7F;
+            } else {
+                ier &= ~value;
+            }
+            updateIrq();
+            break;
+    }
+
+    portsChanged(old_a, old_b);
+}
+
+void Via6522::setCA1(bool level) {
+    if (level != ca1) {
+        ca1 = level;
+        if (level == static_cast<bool>(pcr & 0x01)) {
+            setFlags(irq_ca1);
+        }
+    }
+}
+
+void Via6522::setCB1(bool level) {
+    if (level != cb1) {
+        cb1 = level;
+        if (level == static_cast<bool>(pcr & 0x10)) {
+            setFlags(irq_cb1);
+        }
+    }
+}
+
+Byte Via6522::portA() const {
+    return (ora & ddra) | (input_a & ~ddra);
+}
+
+Byte Via6522::portB() const {
+    Byte value = (orb & ddrb) | (input_b & ~ddrb);
+    if (acr & 0x80) {
+        value = (value & 0x7F) | (pb7 ? 0x80 : 0x00);
+    }
+    return value;
+}
+
+Word Via6522::timer1() {
+    sync();
+    return static_cast<Word>(t1_counter);
+}
+
+Word Via6522::timer2() {
+    sync();
+    return t2_counter;
+}
+
+// Counts down both timers. Free running timer 1 goes N ... 0, -1, N again, a period of N + 2
+void Via6522::catchUp(u64 cycles) {
+    if (!continuous()) {
+        t1_counter = static_cast<s32>((static_cast<u64>(t1_counter) - cycles) & 0xFFFF);
+    } else if (cycles <= static_cast<u64>(t1_counter + 1)) {
+        t1_counter -= static_cast<s32>(cycles);
+    } else {
+        u64 after_reload = cycles - static_cast<u64>(t1_counter + 2);
+        t1_counter = t1_latch - static_cast<s32>(after_reload % (t1_latch + 2u));
+    }
+
+    if (!countingPulses()) {
+        t2_counter = static_cast<Word>(t2_counter - cycles);
+    }
+}
+
+// Only the time-outs that set a flag are events, a timer nothing is waiting on is left to catchUp
+void Via6522::scheduleTimer1(u64 now) {
+    if (continuous() ? !t1_started : !t1_armed) {
+        cancel(t1_event);
+        return;
+    }
+    u64 delay = t1_counter >= 0 ? t1_counter + 1u : t1_latch + 2u;
+    post(t1_event, now + delay, [this](u64 cycle) { timer1Timeout(cycle); });
+}
+
+void Via6522::scheduleTimer2(u64 now) {
+    if (!t2_armed || countingPulses()) {
+        cancel(t2_event);
+        return;
+    }
+    post(t2_event, now + t2_counter + 1u, [this](u64 cycle) { timer2Timeout(cycle); });
+}
+
+void Via6522::timer1Timeout(u64 cycle) {
+    Byte old_b = portB();
+
+    if (continuous()) {
+        setFlags(irq_timer1);
+        pb7 = !pb7;
+        scheduleTimer1(cycle);
+    } else if (t1_armed) {
+        // One shot: flags once, then the counter keeps going without raising it again
+        t1_armed = false;
+        setFlags(irq_timer1);
+        pb7 = true;
+    }
+
+    portsChanged(portA(), old_b);
+}
+
+void Via6522::timer2Timeout(u64) {
+    if (t2_armed) {
+        t2_armed = false;
+        setFlags(irq_timer2);
+    }
+}
+
+void Via6522::setFlags(Byte bits) {
+    ifr |= bits;
+    updateIrq();
+}
+
+void Via6522::clearFlags(Byte bits) {
+    if (ifr & bits) {
+        ifr &= ~bits;
+        updateIrq();
+    }
+}
+
+void Via6522::updateIrq() {
+    cpu.setIRQ(irq_source, (ifr & ier & 0x7F) != 0);
+}
+
+void Via6522::portsChanged(Byte old_a, Byte old_b) {
+    Byte a = portA();
+    Byte b = portB();
+    if (a != old_a && on_port_a) {
+        on_port_a(a);
+    }
+    if (b != old_b && on_port_b) {
+        on_port_b(b);
+    }
+}
@@ -0,0 +1,499 @@
+//
+// Instructions-per-second benchmark for CPU::execute
+//
+// Usage: 6502_bench [--cycles N] [--reps N] [--format text|json|csv] [--workload name] [--core table|switch|decoded|jit|all]
+//                   [--timing exact|fast|instructions] [--trace] [--devices] [--classes]
+//                   [--image path [--load addr] [--start addr]]
+//
+// --classes times one loop per opcode class instead of the standard workloads, giving the throughput
+// of each class on each core rather than just its share of the instruction mix
+//
+// --devices maps an idle 6522 VIA and 6551 ACIA with a scheduler attached, the way a machine that has
+// them but is not using them runs. Compare against a run without it for what idle devices cost
+//
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <emulator_6502.h>
+#include <instruction_trace.h>
+#include <scheduler.h>
+#include <via_6522.h>
+#include <acia_6551.h>
+#include "Workloads.h"
+
+using namespace emulator_6502;
+using namespace bench;
+
+namespace {
+
+    // Broad groups of opcodes used for the instruction mix
+    enum OpcodeClass {
+        CLASS_LOAD_STORE,
+        CLASS_ALU,
+        CLASS_SHIFT,
+        CLASS_INC_DEC,
+        CLASS_COMPARE,
+        CLASS_BRANCH,
+        CLASS_JUMP,
+        CLASS_STACK,
+        CLASS_TRANSFER,
+        CLASS_FLAGS,
+        CLASS_SYSTEM,
+        CLASS_COUNT
+    };
+
+    constexpr const char* class_names[CLASS_COUNT] = {
+        "load_store", "alu", "shift", "inc_dec", "compare", "branch",
+        "jump", "stack", "transfer", "flags", "system"
+    };
+
+    // Maps an opcode to its class
+    OpcodeClass opcodeClass(Byte opcode) {
+        switch (opcode) {
+            case 0x90: case 0xB0: case 0xF0: case 0x30: case 0xD0: case 0x10: case 0x50: case 0x70:
+                return CLASS_BRANCH;
+            case 0x4C: case 0x6C: case 0x20: case 0x60:
+                return CLASS_JUMP;
+            case 0x48: case 0x08: case 0x68: case 0x28: case 0xBA: case 0x9A:
+                return CLASS_STACK;
+            case 0xAA: case 0xA8: case 0x8A: case 0x98:
+                return CLASS_TRANSFER;
+            case 0x18: case 0xD8: case 0x58: case 0xB8: case 0x38: case 0xF8: case 0x78:
+                return CLASS_FLAGS;
+            case 0x00: case 0xEA: case 0x40:
+                return CLASS_SYSTEM;
+            case 0xE6: case 0xF6: case 0xEE: case 0xFE: case 0xE8: case 0xC8:
+            case 0xC6: case 0xD6: case 0xCE: case 0xDE: case 0xCA: case 0x88:
+                return CLASS_INC_DEC;
+            case 0xE0: case 0xE4: case 0xEC: case 0xC0: case 0xC4: case 0xCC:
+                return CLASS_COMPARE;
+            default:
+                break;
+        }
+
+        // The remaining opcodes follow the aaabbbcc layout
+        const Byte group = opcode & 0x03;
+        const Byte operation = opcode >> 5;
+        if (group == 0x01) {
+            if (operation == 4 || operation == 5) return CLASS_LOAD_STORE; // STA, LDA
+            if (operation == 6) return CLASS_COMPARE;                      // CMP
+            return CLASS_ALU;                                              // ORA AND EOR ADC SBC
+        }
+        if (group == 0x02 && operation < 4) return CLASS_SHIFT;           // ASL ROL LSR ROR
+        if (opcode == 0x24 || opcode == 0x2C) return CLASS_ALU;           // BIT
+        return CLASS_LOAD_STORE;                                           // LDX LDY STX STY
+    }
+
+    const char* coreName(CPU::Core core) {
+        switch (core) {
+            case CPU::Core::Switch:  return "switch";
+            case CPU::Core::Decoded: return "decoded";
+            case CPU::Core::Jit:     return "jit";
+            default:                 return "table";
+        }
+    }
+
+    const char* timingName(CPU::Timing timing) {
+        switch (timing) {
+            case CPU::Timing::Fast:         return "fast";
+            case CPU::Timing::Instructions: return "instructions";
+            default:                        return "exact";
+        }
+    }
+
+    // A ready to run machine
+    struct Machine {
+        CPU cpu{};
+        std::unique_ptr<Memory> memory = std::make_unique<Memory>();
+    };
+
+    // Results for a single workload
+    struct Result {
+        std::string name;
+        std::string core;
+        std::string error;
+        s32 budget = 0;
+        long long cycles = 0;
+        long long instructions = 0;
+        double seconds = 0.0;
+        std::array<long long, CLASS_COUNT> classes{};
+    };
+
+    struct Options {
+        s32 cycles = 20'000'000;
+        int reps = 5;
+        std::string format = "text";
+        std::string only;
+        std::string core = "all";
+        CPU::Timing timing = CPU::Timing::Exact;
+        bool trace = false;
+        bool devices = false;
+        bool classes = false;
+        std::string image;
+        long load = 0;
+        long start = -1;
+    };
+
+    // Lays the workload out in memory and resets the CPU into it
+    void prepare(Machine& machine, const Workload& workload) {
+        Memory& memory = *machine.memory;
+        std::vector<Byte> contents(Memory::MAX_MEMORY, 0xEA);
+
+        // Pointers and source data used by the indirect / copy workloads
+        contents[0x10] = 0x00;
+        contents[0x11] = 0x10;
+        for (u32 i = 0; i < 0x100; i++) {
+            contents[0x1000 + i] = static_cast<Byte>(i);
+        }
+
+        for (size_t i = 0; i < workload.program.size() && workload.load_address + i < Memory::MAX_MEMORY; i++) {
+            contents[workload.load_address + i] = workload.program[i];
+        }
+
+        // Images that cover the vectors keep their own, otherwise point them at the start
+        if (workload.load_address + workload.program.size() <= 0xFFFC) {
+            contents[0xFFFC] = workload.start_address & 0xFF;
+            contents[0xFFFD] = workload.start_address >> 8;
+            contents[0xFFFE] = workload.start_address & 0xFF;
+            contents[0xFFFF] = workload.start_address >> 8;
+        }
+        memory.copyIn(contents.data());
+
+        machine.cpu.reset(memory);
+        machine.cpu.PC = workload.start_address;
+    }
+
+    // Steps through the budget one instruction at a time to count instructions, cycles and the class mix
+    void profile(Machine& machine, Result& result, const Options& options) {
+        Memory& memory = *machine.memory;
+        CPU& cpu = machine.cpu;
+        s32 remaining = result.budget;
+
+        while (remaining > 0) {
+            s32 used = 0;
+            Word pc = cpu.PC;
+            Byte opcode = cpu.fetchByte(used, memory);
+            InstructionHandler handler = dispatch_table[opcode];
+            if (!handler) {
+                char buffer[64];
+                std::snprintf(buffer, sizeof(buffer), "invalid opcode 0x%02X at 0x%04X", opcode, pc);
+                result.error = buffer;
+                break;
+            }
+            handler(cpu, used, memory);
+
+            // Charge the budget the same way the timed run's timing policy will
+            s32 charged = -used;
+            if (options.timing == CPU::Timing::Fast) {
+                charged = opcode_table[opcode].cycles;
+            } else if (options.timing == CPU::Timing::Instructions) {
+                charged = 1;
+            }
+            remaining -= charged;
+            result.cycles += charged;
+            result.instructions++;
+            result.classes[opcodeClass(opcode)]++;
+        }
+
+        // Trim the budget so the timed run stops on the same instruction
+        if (!result.error.empty()) {
+            result.budget = static_cast<s32>(result.cycles);
+        }
+    }
+
+    // Runs the workload and returns the median time of a number of timed runs
+    Result runWorkload(const Workload& workload, CPU::Core core, const Options& options) {
+        Result result;
+        result.name = workload.name;
+        result.core = coreName(core);
+        if (options.timing != CPU::Timing::Exact) {
+            result.core += std::string("+") + timingName(options.timing);
+        }
+        if (options.trace) {
+            result.core += "+trace";
+        }
+        if (options.devices) {
+            result.core += "+devices";
+        }
+        result.budget = options.cycles;
+
+        Machine initial;
+        prepare(initial, workload);
+        initial.cpu.core = core;
+
+        Machine counting;
+        counting.cpu = initial.cpu;
+        *counting.memory = *initial.memory;
+        profile(counting, result, options);
+
+        if (result.budget <= 0) {
+            return result;
+        }
+
+        Machine timed;
+        InstructionTrace trace;
+        Scheduler scheduler;
+        Via6522 via(timed.cpu, scheduler);
+        Acia6551 acia(timed.cpu, scheduler);
+        std::vector<double> samples;
+        for (int rep = 0; rep < options.reps; rep++) {
+            timed.cpu = initial.cpu;
+            *timed.memory = *initial.memory;
+            if (options.trace) {
+                timed.cpu.trace = &trace;
+            }
+            if (options.devices) {
+                timed.cpu.scheduler = &scheduler;
+                timed.memory->bus.mapDevice(0x6000, 0x100, &via);
+                timed.memory->bus.mapDevice(0x5000, 0x100, &acia);
+            }
+
+            auto begin = std::chrono::steady_clock::now();
+            if (options.timing == CPU::Timing::Fast) {
+                timed.cpu.execute<CPU::Timing::Fast>(result.budget, *timed.memory);
+            } else if (options.timing == CPU::Timing::Instructions) {
+                timed.cpu.execute<CPU::Timing::Instructions>(result.budget, *timed.memory);
+            } else {
+                timed.cpu.execute(result.budget, *timed.memory);
+            }
+            auto end = std::chrono::steady_clock::now();
+
+            samples.push_back(std::chrono::duration<double>(end - begin).count());
+        }
+
+        std::sort(samples.begin(), samples.end());
+        result.seconds = samples[samples.size() / 2];
+        return result;
+    }
+
+    double emulatedMHz(const Result& result) {
+        return result.seconds > 0 ? result.cycles / result.seconds / 1e6 : 0.0;
+    }
+
+    double nsPerInstruction(const Result& result) {
+        return result.instructions > 0 ? result.seconds * 1e9 / result.instructions : 0.0;
+    }
+
+    double mips(const Result& result) {
+        return result.seconds > 0 ? result.instructions / result.seconds / 1e6 : 0.0;
+    }
+
+    void printText(const std::vector<Result>& results) {
+        std::printf("%-16s %-8s %12s %12s %10s %10s %10s\n", "workload", "core", "cycles", "instructions", "ns/instr",
+                    "MIPS", "emu MHz");
+        for (const Result& result : results) {
+            std::printf("%-16s %-8s %12lld %12lld %10.2f %10.2f %10.2f\n", result.name.c_str(), result.core.c_str(), result.cycles,
+                        result.instructions, nsPerInstruction(result), mips(result), emulatedMHz(result));
+            if (!result.error.empty()) {
+                std::printf("    stopped: %s\n", result.error.c_str());
+            }
+        }
+
+        std::printf("\ninstruction mix (%% of instructions)\n%-16s %-8s", "workload", "core");
+        for (const char* name : class_names) {
+            std::printf(" %10s", name);
+        }
+        std::printf("\n");
+        for (const Result& result : results) {
+            std::printf("%-16s %-8s", result.name.c_str(), result.core.c_str());
+            for (long long count : result.classes) {
+                std::printf(" %10.1f", result.instructions ? 100.0 * count / result.instructions : 0.0);
+            }
+            std::printf("\n");
+        }
+    }
+
+    // Quotes and backslashes escaped, control characters as \u00XX
+    std::string jsonEscape(const std::string& text) {
+        std::string escaped;
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                escaped += '\\';
+                escaped += c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                char code[8];
+                std::snprintf(code, sizeof(code), "\\u%04x", static_cast<unsigned char>(c));
+                escaped += code;
+            } else {
+                escaped += c;
+            }
+        }
+        return escaped;
+    }
+
+    void printJson(const std::vector<Result>& results, const Options& options) {
+        std::printf("{\n  \"benchmark\": \"6502_bench\",\n  \"cycles_per_rep\": %d,\n  \"reps\": %d,\n  \"results\": [\n",
+                    options.cycles, options.reps);
+        for (size_t i = 0; i < results.size(); i++) {
+            const Result& result = results[i];
+            std::printf("    {\"workload\": \"%s\", \"core\": \"%s\", \"cycles\": %lld, \"instructions\": %lld, \"seconds\": %.9f, "
+                        "\"ns_per_instruction\": %.4f, \"mips\": %.4f, \"emulated_mhz\": %.4f, \"error\": \"%s\", \"classes\": {",
+                        jsonEscape(result.name).c_str(), result.core.c_str(), result.cycles, result.instructions, result.seconds,
+                        nsPerInstruction(result), mips(result), emulatedMHz(result), jsonEscape(result.error).c_str());
+            for (int c = 0; c < CLASS_COUNT; c++) {
+                std::printf("%s\"%s\": %lld", c ? ", " : "", class_names[c], result.classes[c]);
+            }
+            std::printf("}}%s\n", i + 1 < results.size() ? "," : "");
+        }
+        std::printf("  ]\n}\n");
+    }
+
+    void printCsv(const std::vector<Result>& results) {
+        std::printf("workload,core,cycles,instructions,seconds,ns_per_instruction,mips,emulated_mhz");
+        for (const char* name : class_names) {
+            std::printf(",%s", name);
+        }
+        std::printf(",error\n");
+        for (const Result& result : results) {
+            std::printf("%s,%s,%lld,%lld,%.9f,%.4f,%.4f,%.4f", result.name.c_str(), result.core.c_str(), result.cycles,
+                        result.instructions, result.seconds, nsPerInstruction(result), mips(result), emulatedMHz(result));
+            for (long long count : result.classes) {
+                std::printf(",%lld", count);
+            }
+            std::printf(",%s\n", result.error.c_str());
+        }
+    }
+
+    // Loads a raw binary image (e.g. Klaus Dormann's 6502_functional_test.bin) as a workload
+    bool imageWorkload(const Options& options, Workload& workload) {
+        FILE* file = std::fopen(options.image.c_str(), "rb");
+        if (!file) {
+            std::fprintf(stderr, "Unable to open image: %s\n", options.image.c_str());
+            return false;
+        }
+
+        workload.name = "image";
+        workload.description = options.image;
+        workload.load_address = static_cast<Word>(options.load);
+        workload.program.resize(Memory::MAX_MEMORY - workload.load_address);
+        workload.program.resize(std::fread(workload.program.data(), 1, workload.program.size(), file));
+        std::fclose(file);
+
+        if (options.start >= 0) {
+            workload.start_address = static_cast<Word>(options.start);
+        } else {
+            // No start given, use the image's own reset vector
+            Word vector = 0xFFFC - workload.load_address;
+            if (vector + 1u >= workload.program.size()) {
+                std::fprintf(stderr, "Image has no reset vector, pass --start\n");
+                return false;
+            }
+            workload.start_address = workload.program[vector] | (workload.program[vector + 1] << 8);
+        }
+        return true;
+    }
+
+    void printUsage(const char* program) {
+        std::fprintf(stderr,
+                     "Usage: %s [--cycles N] [--reps N] [--format text|json|csv] [--workload name]\n"
+                     "          [--core table|switch|decoded|jit|all] [--timing exact|fast|instructions] [--trace]\n"
+                     "          [--devices] [--classes] [--image path [--load addr] [--start addr]]\n", program);
+    }
+
+    bool parseOptions(int argc, char** argv, Options& options) {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            bool has_value = i + 1 < argc;
+
+            if (arg == "--cycles" && has_value) {
+                options.cycles = static_cast<s32>(std::strtol(argv[++i], nullptr, 0));
+            } else if (arg == "--reps" && has_value) {
+                options.reps = std::max(1, std::atoi(argv[++i]));
+            } else if (arg == "--format" && has_value) {
+                options.format = argv[++i];
+                if (options.format != "text" && options.format != "json" && options.format != "csv") {
+                    std::fprintf(stderr, "Unknown format: %s\n", options.format.c_str());
+                    printUsage(argv[0]);
+                    return false;
+                }
+            } else if (arg == "--workload" && has_value) {
+                options.only = argv[++i];
+            } else if (arg == "--core" && has_value) {
+                options.core = argv[++i];
+                if (options.core != "table" && options.core != "switch" && options.core != "decoded" &&
+                    options.core != "jit" && options.core != "all") {
+                    std::fprintf(stderr, "Unknown core: %s\n", options.core.c_str());
+                    printUsage(argv[0]);
+                    return false;
+                }
+            } else if (arg == "--timing" && has_value) {
+                std::string name = argv[++i];
+                if (name == "fast") {
+                    options.timing = CPU::Timing::Fast;
+                } else if (name == "instructions") {
+                    options.timing = CPU::Timing::Instructions;
+                } else if (name != "exact") {
+                    std::fprintf(stderr, "Unknown timing: %s\n", name.c_str());
+                    return false;
+                }
+            } else if (arg == "--trace") {
+                options.trace = true;
+            } else if (arg == "--devices") {
+                options.devices = true;
+            } else if (arg == "--classes") {
+                options.classes = true;
+            } else if (arg == "--image" && has_value) {
+                options.image = argv[++i];
+            } else if (arg == "--load" && has_value) {
+                options.load = std::strtol(argv[++i], nullptr, 0);
+            } else if (arg == "--start" && has_value) {
+                options.start = std::strtol(argv[++i], nullptr, 0);
+            } else {
+                printUsage(argv[0]);
+                return false;
+            }
+        }
+
+        return options.cycles > 0 && options.load >= 0 && options.load < static_cast<long>(Memory::MAX_MEMORY);
+    }
+
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        return 1;
+    }
+
+    std::vector<Workload> workloads = options.classes ? classWorkloads() : builtinWorkloads();
+    if (!options.image.empty()) {
+        Workload image;
+        if (!imageWorkload(options, image)) {
+            return 1;
+        }
+        workloads.push_back(image);
+    }
+
+    std::vector<CPU::Core> cores;
+    for (CPU::Core core : { CPU::Core::DispatchTable, CPU::Core::Switch, CPU::Core::Decoded, CPU::Core::Jit }) {
+        if (options.core == "all" || options.core == coreName(core)) {
+            cores.push_back(core);
+        }
+    }
+
+    std::vector<Result> results;
+    for (const Workload& workload : workloads) {
+        if (options.only.empty() || options.only == workload.name) {
+            for (CPU::Core core : cores) {
+                results.push_back(runWorkload(workload, core, options));
+            }
+        }
+    }
+
+    if (options.format == "json") {
+        printJson(results, options);
+    } else if (options.format == "csv") {
+        printCsv(results);
+    } else {
+        printText(results);
+    }
+
+    return 0;
+}
@@ -0,0 +1,209 @@
+//
+// Benchmark workloads for the 6502 emulator
+//
+
+#ifndef BENCH_WORKLOADS_H
+#define BENCH_WORKLOADS_H
+
+#include <string>
+#include <vector>
+#include <emulator_6502.h>
+
+namespace bench {
+
+    using emulator_6502::Byte;
+    using emulator_6502::Word;
+
+    // A program image plus where it lives in memory
+    struct Workload {
+        std::string name;
+        std::string description;
+        Word load_address;
+        Word start_address;
+        std::vector<Byte> program;
+    };
+
+    // Tight arithmetic / logic loop over immediate operands
+    inline Workload aluWorkload() {
+        return {
+            "alu", "Immediate ADC/SBC/AND/ORA/EOR/CMP and accumulator shifts", 0x8000, 0x8000,
+            {
+                0xA2, 0x00,         // 8000  LDX #$00
+                0xA9, 0x12,         // 8002  loop: LDA #$12
+                0x69, 0x34,         // 8004  ADC #$34
+                0x49, 0xFF,         // 8006  EOR #$FF
+                0x29, 0x0F,         // 8008  AND #$0F
+                0x09, 0x80,         // 800A  ORA #$80
+                0x0A,               // 800C  ASL A
+                0x4A,               // 800D  LSR A
+                0x2A,               // 800E  ROL A
+                0x6A,               // 800F  ROR A
+                0xC9, 0x10,         // 8010  CMP #$10
+                0xE9, 0x01,         // 8012  SBC #$01
+                0xE8,               // 8014  INX
+                0xD0, 0xEB,         // 8015  BNE loop
+                0x4C, 0x00, 0x80,   // 8017  JMP $8000
+            }
+        };
+    }
+
+    // Copies a page with absolute,Y and absolute,X loads and stores
+    inline Workload memcpyWorkload() {
+        return {
+            "memcpy", "Page copies using LDA/STA absolute,X and absolute,Y", 0x8000, 0x8000,
+            {
+                0xA0, 0x00,         // 8000  LDY #$00
+                0xB9, 0x00, 0x10,   // 8002  loop1: LDA $1000,Y
+                0x99, 0x00, 0x20,   // 8005  STA $2000,Y
+                0xC8,               // 8008  INY
+                0xD0, 0xF7,         // 8009  BNE loop1
+                0xA2, 0x00,         // 800B  LDX #$00
+                0xBD, 0x00, 0x10,   // 800D  loop2: LDA $1000,X
+                0x9D, 0x00, 0x30,   // 8010  STA $3000,X
+                0xE8,               // 8013  INX
+                0xD0, 0xF7,         // 8014  BNE loop2
+                0x4C, 0x00, 0x80,   // 8016  JMP $8000
+            }
+        };
+    }
+
+    // Every conditional branch, both taken and not taken
+    inline Workload branchWorkload() {
+        return {
+            "branch", "All conditional branches, taken and not taken", 0x8000, 0x8000,
+            {
+                0xA2, 0x00,         // 8000  LDX #$00
+                0xA9, 0x00,         // 8002  loop: LDA #$00
+                0xF0, 0x00,         // 8004  BEQ +0    (taken)
+                0xD0, 0xFE,         // 8006  BNE *     (not taken)
+                0x30, 0xFE,         // 8008  BMI *     (not taken)
+                0x10, 0x00,         // 800A  BPL +0    (taken)
+                0x38,               // 800C  SEC
+                0xB0, 0x00,         // 800D  BCS +0    (taken)
+                0x90, 0xFE,         // 800F  BCC *     (not taken)
+                0x18,               // 8011  CLC
+                0x90, 0x00,         // 8012  BCC +0    (taken)
+                0xB8,               // 8014  CLV
+                0x50, 0x00,         // 8015  BVC +0    (taken)
+                0x70, 0xFE,         // 8017  BVS *     (not taken)
+                0xA9, 0x80,         // 8019  LDA #$80
+                0x30, 0x00,         // 801B  BMI +0    (taken)
+                0xCA,               // 801D  DEX
+                0xD0, 0xE2,         // 801E  BNE loop
+                0x4C, 0x00, 0x80,   // 8020  JMP $8000
+            }
+        };
+    }
+
+    // Nested subroutine calls
+    inline Workload callWorkload() {
+        return {
+            "call", "Nested JSR/RTS pairs", 0x8000, 0x8000,
+            {
+                0x20, 0x0A, 0x80,   // 8000  loop: JSR sub1
+                0x20, 0x0E, 0x80,   // 8003  JSR sub2
+                0xEA,               // 8006  NOP
+                0x4C, 0x00, 0x80,   // 8007  JMP loop
+                0x20, 0x0E, 0x80,   // 800A  sub1: JSR sub2
+                0x60,               // 800D  RTS
+                0xEA,               // 800E  sub2: NOP
+                0x60,               // 800F  RTS
+            }
+        };
+    }
+
+    // Mixed image touching every addressing mode, in the spirit of Klaus Dormann's functional test
+    inline Workload functionalWorkload() {
+        return {
+            "functional", "Mixed instructions across every addressing mode", 0x8000, 0x8000,
+            {
+                0xA2, 0x00,         // 8000  LDX #$00
+                0xA0, 0x00,         // 8002  LDY #$00
+                0xA5, 0x30,         // 8004  loop: LDA $30
+                0xB5, 0x30,         // 8006  LDA $30,X
+                0xAD, 0x00, 0x10,   // 8008  LDA $1000
+                0xBD, 0x00, 0x10,   // 800B  LDA $1000,X
+                0xA1, 0x10,         // 800E  LDA ($10,X)
+                0xB1, 0x10,         // 8010  LDA ($10),Y
+                0x65, 0x31,         // 8012  ADC $31
+                0x75, 0x31,         // 8014  ADC $31,X
+                0x6D, 0x01, 0x10,   // 8016  ADC $1001
+                0xE5, 0x32,         // 8019  SBC $32
+                0x24, 0x33,         // 801B  BIT $33
+                0x2C, 0x02, 0x10,   // 801D  BIT $1002
+                0xE6, 0x40,         // 8020  INC $40
+                0xC6, 0x41,         // 8022  DEC $41
+                0xEE, 0x00, 0x11,   // 8024  INC $1100
+                0xFE, 0x00, 0x11,   // 8027  INC $1100,X
+                0x06, 0x42,         // 802A  ASL $42
+                0x46, 0x43,         // 802C  LSR $43
+                0x26, 0x44,         // 802E  ROL $44
+                0x66, 0x45,         // 8030  ROR $45
+                0x48,               // 8032  PHA
+                0x08,               // 8033  PHP
+                0x28,               // 8034  PLP
+                0x68,               // 8035  PLA
+                0xC5, 0x30,         // 8036  CMP $30
+                0xE4, 0x31,         // 8038  CPX $31
+                0xC4, 0x32,         // 803A  CPY $32
+                0x85, 0x50,         // 803C  STA $50
+                0x8D, 0x00, 0x12,   // 803E  STA $1200
+                0x99, 0x00, 0x12,   // 8041  STA $1200,Y
+                0x86, 0x51,         // 8044  STX $51
+                0x84, 0x52,         // 8046  STY $52
+                0xC8,               // 8048  INY
+                0xE8,               // 8049  INX
+                0xD0, 0xB8,         // 804A  BNE loop
+                0x4C, 0x00, 0x80,   // 804C  JMP $8000
+            }
+        };
+    }
+
+    inline std::vector<Workload> builtinWorkloads() {
+        return { aluWorkload(), memcpyWorkload(), branchWorkload(), callWorkload(), functionalWorkload() };
+    }
+
+    // One opcode class on its own: 'body' repeated to fill most of a page and a JMP back, so the time
+    // per instruction is almost all that class. 'setup' runs once before the loop
+    inline Workload classWorkload(const std::string& name, const std::string& description,
+                                  const std::vector<Byte>& setup, const std::vector<Byte>& body) {
+        Workload workload{ "class_" + name, description, 0x8000, 0x8000, setup };
+        const Word loop = static_cast<Word>(0x8000 + setup.size());
+        while (workload.program.size() + body.size() + 3 <= 0xF0) {
+            workload.program.insert(workload.program.end(), body.begin(), body.end());
+        }
+        workload.program.insert(workload.program.end(), { 0x4C, static_cast<Byte>(loop & 0xFF), static_cast<Byte>(loop >> 8) });
+        return workload;
+    }
+
+    // Per class throughput, named after the classes in the instruction mix
+    inline std::vector<Workload> classWorkloads() {
+        Workload jump = classWorkload("jump", "JSR/RTS pairs", {}, { 0x20, 0x00, 0x81 });     // JSR $8100
+        jump.program.resize(0x100, 0xEA);
+        jump.program.push_back(0x60);                                                           // 8100  RTS
+
+        return {
+            classWorkload("load_store", "LDA/STA/LDX/STX/LDY/STY in zero page, absolute and absolute,X", {},
+                          { 0xA5, 0x10, 0x85, 0x11, 0xAD, 0x00, 0x10, 0x8D, 0x00, 0x12, 0xA6, 0x10,
+                            0x86, 0x13, 0xA4, 0x10, 0x84, 0x14, 0xBD, 0x00, 0x10 }),
+            classWorkload("alu", "ADC/AND/ORA/EOR/SBC immediate and BIT", {},
+                          { 0x69, 0x01, 0x29, 0xFF, 0x09, 0x00, 0x49, 0x00, 0xE9, 0x01, 0x24, 0x10 }),
+            classWorkload("shift", "ASL/LSR/ROL/ROR on A and zero page", {},
+                          { 0x0A, 0x4A, 0x2A, 0x6A, 0x06, 0x20, 0x46, 0x21 }),
+            classWorkload("inc_dec", "INX/INY/DEX/DEY and INC/DEC zero page", {},
+                          { 0xE8, 0xC8, 0xCA, 0x88, 0xE6, 0x20, 0xC6, 0x20 }),
+            classWorkload("compare", "CMP/CPX/CPY immediate and zero page", {},
+                          { 0xC9, 0x01, 0xE0, 0x02, 0xC0, 0x03, 0xC5, 0x10 }),
+            classWorkload("branch", "Branches to the next instruction, taken and not taken", { 0xA2, 0x01 },
+                          { 0xD0, 0x00, 0xF0, 0x00, 0x10, 0x00, 0x30, 0x00, 0x90, 0x00 }),
+            jump,
+            classWorkload("stack", "PHA/PLA/PHP/PLP", {}, { 0x48, 0x68, 0x08, 0x28 }),
+            classWorkload("transfer", "TAX/TAY/TXA/TYA", {}, { 0xAA, 0xA8, 0x8A, 0x98 }),
+            classWorkload("flags", "CLC/SEC/CLD/CLV", {}, { 0x18, 0x38, 0xD8, 0xB8 }),
+            classWorkload("system", "NOP", {}, { 0xEA }),
+        };
+    }
+
+}
+
+#endif //BENCH_WORKLOADS_H